@@ -1,35 +1,148 @@
 #include "scheduler.h"
 
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
 #include <atomic>
 #include <condition_variable>
+#include <iostream>
 #include <mutex>
+#include <optional>
 #include <set>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace async {
 
+using TimePoint = std::chrono::system_clock::time_point;
+
 struct Entry {
   Fn fn;
   std::weak_ptr<void> sentinel;
-  std::chrono::system_clock::time_point at;
+  TimePoint at;
   std::chrono::microseconds period;
 
   bool operator<(const Entry &rhs) const { return at < rhs.at; }
 };
 
-struct CVNotifier {
-  explicit CVNotifier(std::shared_ptr<std::condition_variable> cv) : _cv{std::move(cv)} {}
-  ~CVNotifier() { _cv->notify_all(); }
+// Blocks the scheduler loop on a condition variable.
+class ConditionWaiter final {
+ public:
+  void wake() { _cv.notify_all(); }
+
+  template <typename Predicate>
+  void wait(std::unique_lock<std::mutex> &lock,
+            std::optional<TimePoint> deadline,
+            Predicate stop_waiting) {
+    if (deadline) {
+      _cv.wait_until(lock, *deadline, stop_waiting);
+    } else {
+      _cv.wait(lock, stop_waiting);
+    }
+  }
+
+ private:
+  std::condition_variable _cv;
+};
+
+// Blocks the scheduler loop in poll(2), on the watched descriptors plus a self-pipe for wakeups.
+class PollWaiter final {
+ public:
+  PollWaiter() {
+    if (pipe(_pipe) == 0) {
+      for (auto fd : _pipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+      }
+    } else {
+      std::cerr << "Failed to create wakeup pipe" << std::endl;
+    }
+  }
+  ~PollWaiter() {
+    for (auto fd : _pipe) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  void wake() {
+    if (!_woken.exchange(true)) {
+      char c = 0;
+      (void)write(_pipe[1], &c, 1);
+    }
+  }
+
+  void watch(int fd, short events, PollThread::OnReady on_ready) {
+    _watches[fd] = {events, std::move(on_ready)};
+  }
+  void unwatch(int fd) { _watches.erase(fd); }
+
+  template <typename Predicate>
+  void wait(std::unique_lock<std::mutex> &lock,
+            std::optional<TimePoint> deadline,
+            Predicate stop_waiting) {
+    if (stop_waiting()) {
+      return;
+    }
+    auto timeout = -1;
+    if (deadline) {
+      auto remaining = *deadline - std::chrono::system_clock::now();
+      timeout = std::max<int>(0, std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+    }
+    lock.unlock();
+
+    _fds.clear();
+    _fds.push_back({.fd = _pipe[0], .events = POLLIN});
+    for (auto &[fd, watch] : _watches) {
+      _fds.push_back({.fd = fd, .events = watch.first});
+    }
+
+    if (poll(_fds.data(), _fds.size(), timeout) > 0) {
+      if (_fds[0].revents) {
+        char buffer[64];
+        while (read(_pipe[0], buffer, sizeof(buffer)) > 0) {
+        }
+        // Cleared after draining: anything scheduled before this is picked up by the caller.
+        _woken = false;
+      }
+      // Callbacks may change the watches, so look each one up again.
+      for (auto it = _fds.begin() + 1; it != _fds.end(); ++it) {
+        if (auto watch = _watches.find(it->fd); it->revents && watch != _watches.end()) {
+          auto on_ready = watch->second.second;
+          on_ready(it->revents);
+        }
+      }
+    }
+    lock.lock();
+  }
+
+ private:
+  int _pipe[2] = {-1, -1};
+  std::atomic_bool _woken = false;
+  std::unordered_map<int, std::pair<short, PollThread::OnReady>> _watches;
+  std::vector<pollfd> _fds;
+};
+
+template <typename Waiter>
+struct Notifier {
+  explicit Notifier(std::shared_ptr<Waiter> waiter) : _waiter{std::move(waiter)} {}
+  ~Notifier() { _waiter->wake(); }
 
  private:
-  std::shared_ptr<std::condition_variable> _cv;
+  std::shared_ptr<Waiter> _waiter;
 };
 
+template <typename Waiter>
 class SchedulerImpl final : public Scheduler {
  public:
+  explicit SchedulerImpl(std::shared_ptr<Waiter> waiter) : _waiter{std::move(waiter)} {}
+
   Lifetime schedule(Fn &&fn, const Options &options = {}) final {
-    auto sentinel = std::make_shared<CVNotifier>(_cv);
+    auto sentinel = std::make_shared<Notifier<Waiter>>(_waiter);
     {
       auto lock = std::unique_lock(_mutex);
       _queue.insert(Entry{
@@ -39,7 +152,7 @@ class SchedulerImpl final : public Scheduler {
           .period = options.period,
       });
     }
-    _cv->notify_all();
+    _waiter->wake();
     return sentinel;
   }
 
@@ -50,11 +163,8 @@ class SchedulerImpl final : public Scheduler {
     };
 
     for (;;) {
-      if (_queue.empty()) {
-        _cv->wait(lock, stop_waiting);
-      } else {
-        _cv->wait_until(lock, _queue.begin()->at, stop_waiting);
-      }
+      _waiter->wait(lock, _queue.empty() ? std::nullopt : std::optional(_queue.begin()->at),
+                    stop_waiting);
 
       if (_stop && _queue.empty()) {
         break;
@@ -91,7 +201,7 @@ class SchedulerImpl final : public Scheduler {
 
   void stop() {
     _stop = true;
-    _cv->notify_all();
+    _waiter->wake();
   }
 
  private:
@@ -102,12 +212,13 @@ class SchedulerImpl final : public Scheduler {
   }
 
   std::mutex _mutex;
-  std::shared_ptr<std::condition_variable> _cv = std::make_shared<std::condition_variable>();
+  std::shared_ptr<Waiter> _waiter;
   std::atomic_bool _stop = false;
   std::set<Entry> _queue;
 };
 
-class ThreadImpl final : public Thread {
+template <typename Base, typename Waiter>
+class ThreadImpl : public Base {
  public:
   explicit ThreadImpl(std::string_view name)
       : _thread{[this, name = std::string(name)] {
@@ -124,13 +235,31 @@ class ThreadImpl final : public Thread {
 
   Scheduler &scheduler() final { return *_scheduler; }
 
+ protected:
+  std::shared_ptr<Waiter> _waiter = std::make_shared<Waiter>();
+
  private:
-  std::unique_ptr<SchedulerImpl> _scheduler = std::make_unique<SchedulerImpl>();
+  std::unique_ptr<SchedulerImpl<Waiter>> _scheduler =
+      std::make_unique<SchedulerImpl<Waiter>>(_waiter);
   std::thread _thread;
 };
 
+class PollThreadImpl final : public ThreadImpl<PollThread, PollWaiter> {
+ public:
+  using ThreadImpl::ThreadImpl;
+
+  void watch(int fd, short events, OnReady on_ready) final {
+    _waiter->watch(fd, events, std::move(on_ready));
+  }
+  void unwatch(int fd) final { _waiter->unwatch(fd); }
+};
+
 std::unique_ptr<Thread> Thread::create(std::string_view name) {
-  return std::make_unique<ThreadImpl>(name);
+  return std::make_unique<ThreadImpl<Thread, ConditionWaiter>>(name);
+}
+
+std::unique_ptr<PollThread> PollThread::create(std::string_view name) {
+  return std::make_unique<PollThreadImpl>(name);
 }
 
 }  // namespace async
@@ -27,4 +27,16 @@ struct Thread {
   static std::unique_ptr<Thread> create(std::string_view name = "");
 };
 
+// Thread that waits on file descriptors in between scheduled work.
+struct PollThread : Thread {
+  using OnReady = std::function<void(short revents)>;
+
+  // Calls |on_ready| on this thread whenever |fd| is ready for any of |events| (POLLIN, POLLOUT),
+  // replacing any previous watch of |fd|. Must be called on this thread.
+  virtual void watch(int fd, short events, OnReady on_ready) = 0;
+  virtual void unwatch(int fd) = 0;
+
+  static std::unique_ptr<PollThread> create(std::string_view name = "");
+};
+
 }  // namespace async
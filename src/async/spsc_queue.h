@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+
+namespace async {
+
+// Bounded queue for exactly one producer and one consumer thread. Neither side ever blocks, so
+// it's safe to push from callbacks that mustn't wait on the consumer.
+template <typename T, size_t N>
+class SpscQueue final {
+ public:
+  // Returns false if the queue is full.
+  bool push(T value) {
+    auto tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    _items[tail % N] = std::move(value);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> pop() {
+    auto head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) {
+      return {};
+    }
+    auto value = std::move(_items[head % N]);
+    _head.store(head + 1, std::memory_order_release);
+    return value;
+  }
+
+ private:
+  std::array<T, N> _items;
+  std::atomic<size_t> _head = 0;
+  std::atomic<size_t> _tail = 0;
+};
+
+}  // namespace async
@@ -0,0 +1,49 @@
+#include "packet.h"
+
+namespace ddp {
+namespace {
+
+constexpr size_t kHeaderSize = 10;
+constexpr size_t kTimecodeSize = 4;
+
+constexpr uint8_t kVersionMask = 0xc0;
+constexpr uint8_t kVersion1 = 0x40;
+constexpr uint8_t kTimecodeFlag = 0x10;
+constexpr uint8_t kReplyFlag = 0x04;
+constexpr uint8_t kQueryFlag = 0x02;
+constexpr uint8_t kPushFlag = 0x01;
+
+constexpr uint8_t kDisplayId = 1;
+constexpr uint8_t kAllDevicesId = 255;
+
+// Undefined, which senders use for RGB, the RGB of older senders and RGB with 8 bits per channel.
+bool isRgb(uint8_t data_type) {
+  return data_type == 0x00 || data_type == 0x01 || data_type == 0x0b;
+}
+
+}  // namespace
+
+std::optional<Packet> parsePacket(std::string_view bytes) {
+  if (bytes.size() < kHeaderSize) {
+    return {};
+  }
+  auto byte = [bytes](size_t i) -> uint32_t { return uint8_t(bytes[i]); };
+  auto flags = byte(0);
+  if ((flags & kVersionMask) != kVersion1 || flags & (kReplyFlag | kQueryFlag)) {
+    return {};
+  }
+  if (!isRgb(byte(2)) || (byte(3) != kDisplayId && byte(3) != kAllDevicesId)) {
+    return {};
+  }
+  auto offset = byte(4) << 24 | byte(5) << 16 | byte(6) << 8 | byte(7);
+  auto length = byte(8) << 8 | byte(9);
+  auto header_size = kHeaderSize + (flags & kTimecodeFlag ? kTimecodeSize : 0);
+  if (bytes.size() < header_size + length) {
+    return {};
+  }
+  return Packet{.push = bool(flags & kPushFlag),
+                .offset = offset,
+                .data = bytes.substr(header_size, length)};
+}
+
+}  // namespace ddp
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace ddp {
+
+// That DDP sources send to unless told otherwise.
+constexpr int kDefaultPort = 4048;
+
+// Pixel data for the display, from a packet of the Distributed Display Protocol
+// (http://www.3waylabs.com/ddp/).
+struct Packet {
+  // The frame is complete and can be shown.
+  bool push = false;
+  // Where |data| goes in the frame, in bytes.
+  uint32_t offset = 0;
+  std::string_view data;
+};
+
+// Returns nullopt for packets that aren't RGB pixel data for the display, such as queries,
+// replies and packets for other destinations, and for packets that are cut short.
+std::optional<Packet> parsePacket(std::string_view bytes);
+
+}  // namespace ddp
@@ -0,0 +1,178 @@
+#include "receiver.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace ddp {
+namespace {
+
+using namespace std::chrono_literals;
+
+// Largest packet that DDP sources send, with room to spare.
+constexpr size_t kMaxPacketSize = 2048;
+constexpr auto kLogInterval = 10s;
+
+int bindSocket(int port) {
+  auto fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return fd;
+  }
+  auto addr = sockaddr_in{.sin_family = AF_INET,
+                          .sin_port = htons(port),
+                          .sin_addr = {.s_addr = htonl(INADDR_ANY)}};
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+}  // namespace
+
+Receiver::Receiver(async::Scheduler &main_scheduler, render::Renderer &renderer, int port)
+    : _main_scheduler{main_scheduler},
+      _renderer{renderer},
+      _size{renderer.size()},
+      _assembling(3 * (1 + _size.x * _size.y), '\0') {
+  _fd = bindSocket(port);
+  if (_fd < 0) {
+    std::cerr << "ddp: failed to listen on port " << port << ": " << std::strerror(errno)
+              << std::endl;
+    return;
+  }
+  auto addr = sockaddr_in{};
+  auto len = socklen_t(sizeof(addr));
+  getsockname(_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  _port = ntohs(addr.sin_port);
+  std::cout << "ddp: listening on port " << _port << std::endl;
+
+  _thread = async::PollThread::create("ddp");
+  _watch = _thread->scheduler().schedule(
+      [this] { _thread->watch(_fd, POLLIN, [this](auto) { onReadable(); }); });
+}
+
+Receiver::~Receiver() {
+  // Nothing comes in from here on.
+  _watch.reset();
+  _thread.reset();
+  _work.reset();
+  if (_fd >= 0) {
+    close(_fd);
+  }
+  if (_taken_over) {
+    _renderer.takeOver([](auto &, auto) { return 0ms; }, {});
+  }
+}
+
+ReceiverStats Receiver::stats() const {
+  return {.packets = _packets,
+          .packets_ignored = _packets_ignored,
+          .frames = _frames,
+          .frames_dropped = _frames_dropped,
+          .frames_shown = _frames_shown};
+}
+
+void Receiver::onReadable() {
+  char buffer[kMaxPacketSize];
+  for (ssize_t n; (n = recv(_fd, buffer, sizeof(buffer), 0)) >= 0;) {
+    onPacket(std::string_view(buffer, n), std::chrono::steady_clock::now());
+  }
+}
+
+void Receiver::onPacket(std::string_view bytes, std::chrono::steady_clock::time_point at) {
+  ++_packets;
+  auto packet = parsePacket(bytes);
+  if (!packet || packet->offset >= _assembling.size()) {
+    ++_packets_ignored;
+    return;
+  }
+  auto data = packet->data.substr(0, _assembling.size() - packet->offset);
+  std::copy(data.begin(), data.end(), _assembling.begin() + packet->offset);
+  if (!packet->push && packet->offset + data.size() < _assembling.size()) {
+    return;
+  }
+  ++_frames;
+
+  auto lock = std::unique_lock(_mutex);
+  _latest.pixels = _assembling;
+  _latest.at = at;
+  // The main thread is already on its way to the one before.
+  if (std::exchange(_has_latest, true)) {
+    ++_frames_dropped;
+    return;
+  }
+  lock.unlock();
+  _work = _main_scheduler.schedule([this] { onFrame(); });
+}
+
+void Receiver::onFrame() {
+  if (_taken_over) {
+    return _renderer.notify();
+  }
+  std::cout << "ddp: taking over the panel" << std::endl;
+  _taken_over = true;
+  _last_log = std::chrono::steady_clock::now();
+  _renderer.takeOver([this](auto &led, auto) { return render(led); }, [this] { onShown(); });
+}
+
+std::chrono::milliseconds Receiver::render(render::LED &led) {
+  {
+    auto lock = std::unique_lock(_mutex);
+    if (_has_latest) {
+      // What was shown before is overwritten in place by the next frame.
+      std::swap(_showing, _latest);
+      _has_latest = false;
+      _measured = false;
+    }
+  }
+  auto idle = std::chrono::steady_clock::now() - _showing.at;
+  if (idle >= kIdleTimeout) {
+    std::cout << "ddp: handing the panel back" << std::endl;
+    _taken_over = false;
+    return 0ms;
+  }
+
+  auto pixel = [this](size_t i) {
+    auto *rgb = reinterpret_cast<const uint8_t *>(&_showing.pixels[3 * i]);
+    return Color(rgb[0], rgb[1], rgb[2]);
+  };
+  led.setLogo(pixel(0));
+  for (int y = 0; y < _size.y; ++y) {
+    for (int x = 0; x < _size.x; ++x) {
+      led.set({x, y}, pixel(1 + y * _size.x + x));
+    }
+  }
+  return std::max<std::chrono::milliseconds>(
+      1ms, std::chrono::ceil<std::chrono::milliseconds>(kIdleTimeout - idle));
+}
+
+void Receiver::onShown() {
+  // Frames are shown again whenever the renderer is notified, only the first time counts.
+  if (std::exchange(_measured, true)) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  ++_frames_shown;
+  _latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - _showing.at));
+  if (now - _last_log < kLogInterval) {
+    return;
+  }
+
+  auto elapsed = std::chrono::duration<double>(now - _last_log);
+  std::sort(_latencies.begin(), _latencies.end());
+  std::cout << "ddp: " << _latencies.size() / elapsed.count() << " fps, "
+            << _frames_dropped << " dropped in total, packet-to-photon p50 "
+            << _latencies[_latencies.size() / 2].count() << "us, p99 "
+            << _latencies[_latencies.size() * 99 / 100].count() << "us" << std::endl;
+  _latencies.clear();
+  _last_log = now;
+}
+
+}  // namespace ddp
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <async/scheduler.h>
+#include <render/renderer.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "packet.h"
+
+namespace ddp {
+
+struct ReceiverStats {
+  uint64_t packets = 0;
+  // Not pixel data for the display, or outside of the frame.
+  uint64_t packets_ignored = 0;
+  uint64_t frames = 0;
+  // Replaced by a newer frame before they could be shown.
+  uint64_t frames_dropped = 0;
+  uint64_t frames_shown = 0;
+};
+
+// Listens for frames over DDP on a thread of its own, and takes over the panel with them for as
+// long as they keep coming, bypassing states altogether. Pixels are 3 bytes each, RGB: the logo
+// first, then the panel row by row from the top left.
+//
+// A frame is shown once a packet pushes it, or once its last pixel is in for sources that don't
+// push. Only the latest frame is kept, so frames that come in faster than the panel is updated
+// are dropped rather than queued.
+class Receiver final {
+ public:
+  // The panel is handed back once no frame has come in for this long.
+  static constexpr auto kIdleTimeout = std::chrono::milliseconds(2000);
+
+  // Must be created on the main thread. 0 picks a free port.
+  Receiver(async::Scheduler &main_scheduler, render::Renderer &, int port = kDefaultPort);
+  ~Receiver();
+
+  int port() const { return _port; }
+  ReceiverStats stats() const;
+
+ private:
+  struct Received {
+    std::string pixels;
+    std::chrono::steady_clock::time_point at;
+  };
+
+  // receiving thread
+  void onReadable();
+  void onPacket(std::string_view bytes, std::chrono::steady_clock::time_point at);
+
+  // main thread
+  void onFrame();
+  std::chrono::milliseconds render(render::LED &);
+  void onShown();
+
+  async::Scheduler &_main_scheduler;
+  render::Renderer &_renderer;
+  render::Coord _size;
+  int _fd = -1;
+  int _port = 0;
+  std::unique_ptr<async::PollThread> _thread;
+  async::Lifetime _watch;
+  // Pixels as the packets of the frame come in, on top of the frame before.
+  std::string _assembling;
+  async::Lifetime _work;
+
+  std::mutex _mutex;
+  Received _latest;
+  // Whether |_latest| is yet to be shown.
+  bool _has_latest = false;
+
+  Received _showing;
+  bool _taken_over = false;
+  bool _measured = true;
+  // Packet-to-photon latencies since the last log.
+  std::vector<std::chrono::microseconds> _latencies;
+  std::chrono::steady_clock::time_point _last_log;
+
+  std::atomic<uint64_t> _packets = 0;
+  std::atomic<uint64_t> _packets_ignored = 0;
+  std::atomic<uint64_t> _frames = 0;
+  std::atomic<uint64_t> _frames_dropped = 0;
+  std::atomic<uint64_t> _frames_shown = 0;
+};
+
+}  // namespace ddp
@@ -0,0 +1,204 @@
+#include "ddp/receiver.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <render/renderer_impl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams frames to a receiver the way a DDP source on the network would, at twice the rate
+// that the SpotiLED panel needs, and checks that they take over from what is displayed, that
+// each is shown or dropped for a newer one, and that the display comes back once they stop.
+// Reports the frame rate shown and the time from sending a frame until it's shown.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr auto kSize = render::Coord{23, 16};
+constexpr int kFrames = 300;
+constexpr auto kFrameInterval = std::chrono::microseconds(1s) / 120;
+const auto kDisplayed = Color(9, 9, 9);
+
+// Keeps what was last shown, and when each frame was, by the number in its logo.
+struct FakeLED final : render::BufferedLED {
+  void clear() final {
+    _drawing = {.size = kSize, .pixels = std::vector<Color>(kSize.x * kSize.y)};
+  }
+  void show() final {
+    auto lock = std::unique_lock(mutex);
+    shown = _drawing;
+    shown_at.emplace_back(shown.logo[0] | shown.logo[1] << 8, std::chrono::steady_clock::now());
+  }
+  render::Coord size() const final { return kSize; }
+  void setLogo(Color color, const Options &) final { _drawing.logo = color; }
+  void set(render::Coord pos, Color color, const Options &) final {
+    _drawing.pixels[pos.y * kSize.x + pos.x] = color;
+  }
+
+  std::mutex mutex;
+  render::Frame shown;
+  std::vector<std::pair<int, std::chrono::steady_clock::time_point>> shown_at;
+
+ private:
+  render::Frame _drawing;
+};
+
+void onMain(async::Scheduler &scheduler, std::function<void()> fn) {
+  std::promise<void> done;
+  auto _ = scheduler.schedule([&] {
+    fn();
+    done.set_value();
+  });
+  done.get_future().get();
+}
+
+void waitFor(std::function<bool()> condition) {
+  for (auto start = std::chrono::steady_clock::now(); !condition();) {
+    assert(std::chrono::steady_clock::now() - start < 5s);
+    std::this_thread::sleep_for(1ms);
+  }
+}
+
+std::string packet(uint8_t flags, uint32_t offset, std::string_view data) {
+  auto bytes = std::string{char(flags), 0, 1, 1, char(offset >> 24), char(offset >> 16),
+                           char(offset >> 8), char(offset), char(data.size() >> 8),
+                           char(data.size())};
+  return bytes + std::string(data);
+}
+
+// The logo carries the number of the frame.
+std::string pixelsOf(int number) {
+  auto pixels = std::string(3 * (1 + kSize.x * kSize.y), '\0');
+  pixels[0] = char(number);
+  pixels[1] = char(number >> 8);
+  for (size_t i = 3; i < pixels.size(); ++i) {
+    pixels[i] = char(number + i);
+  }
+  return pixels;
+}
+
+std::string pixelsOf(const render::Frame &frame) {
+  auto pixels = std::string(frame.logo.begin(), frame.logo.end());
+  for (auto &color : frame.pixels) {
+    pixels.append(color.begin(), color.end());
+  }
+  return pixels;
+}
+
+void testPackets() {
+  auto data = std::string("\x01\x02\x03", 3);
+  auto parsed = ddp::parsePacket(packet(0x41, 6, data));
+  assert(parsed && parsed->push && parsed->offset == 6 && parsed->data == data);
+  // With a timecode.
+  auto with_timecode = packet(0x50, 0, "");
+  with_timecode += std::string(4, '\0') + data;
+  with_timecode[9] = 3;
+  parsed = ddp::parsePacket(with_timecode);
+  assert(parsed && !parsed->push && parsed->data == data);
+  // Queries, other destinations and packets cut short.
+  assert(!ddp::parsePacket(packet(0x43, 0, data)));
+  auto other = packet(0x41, 0, data);
+  other[3] = 2;
+  assert(!ddp::parsePacket(other));
+  assert(!ddp::parsePacket(packet(0x41, 0, data).substr(0, 12)));
+  std::cout << "Packets parsed as expected" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  testPackets();
+
+  auto main_thread = async::Thread::create("main");
+  auto &main_scheduler = main_thread->scheduler();
+  auto led = new FakeLED();
+  std::unique_ptr<render::Renderer> renderer;
+  std::unique_ptr<ddp::Receiver> receiver;
+  onMain(main_scheduler, [&] {
+    renderer = render::createRenderer(main_scheduler, std::unique_ptr<render::BufferedLED>(led));
+    renderer->add([](auto &led, auto) {
+      led.setLogo(kDisplayed);
+      return 1min;
+    });
+    receiver = std::make_unique<ddp::Receiver>(main_scheduler, *renderer, 0);
+  });
+
+  auto fd = socket(AF_INET, SOCK_DGRAM, 0);
+  auto addr = sockaddr_in{.sin_family = AF_INET, .sin_port = htons(receiver->port())};
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  auto err = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  assert(!err);
+  auto send = [fd](std::string bytes) { ::send(fd, bytes.data(), bytes.size(), 0); };
+
+  // In two packets, the second one pushing the frame.
+  auto pixels = pixelsOf(1000);
+  send(packet(0x40, 0, std::string_view(pixels).substr(0, 600)));
+  send(packet(0x41, 600, std::string_view(pixels).substr(600)));
+  waitFor([&] { return receiver->stats().frames_shown == 1; });
+  {
+    auto lock = std::unique_lock(led->mutex);
+    assert(pixelsOf(led->shown) == pixels);
+  }
+  std::cout << "Frame in two packets took over the panel" << std::endl;
+
+  auto sent_at = std::vector<std::chrono::steady_clock::time_point>();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kFrames; ++i) {
+    std::this_thread::sleep_until(start + i * kFrameInterval);
+    sent_at.push_back(std::chrono::steady_clock::now());
+    send(packet(0x41, 0, pixelsOf(i)));
+  }
+  waitFor([&] {
+    auto stats = receiver->stats();
+    return stats.frames == kFrames + 1 && stats.frames_shown + stats.frames_dropped == stats.frames;
+  });
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  auto stats = receiver->stats();
+  assert(stats.packets_ignored == 0);
+  auto fps = (stats.frames_shown - 1) / elapsed.count();
+  assert(fps >= 60);
+
+  auto latencies = std::vector<std::chrono::microseconds>();
+  {
+    auto lock = std::unique_lock(led->mutex);
+    // Frames are shown again when the renderer is notified, only the first time counts.
+    auto seen = std::vector<bool>(kFrames);
+    for (auto [number, at] : led->shown_at) {
+      if (number < kFrames && !seen[number]) {
+        seen[number] = true;
+        latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+            at - sent_at[number]));
+      }
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << "Shown " << fps << " of " << kFrames / elapsed.count() << " fps sent, "
+            << stats.frames_dropped << " dropped, send-to-show p50 "
+            << latencies[latencies.size() / 2].count() << "us, p99 "
+            << latencies[latencies.size() * 99 / 100].count() << "us" << std::endl;
+
+  // The display is back once frames stop coming.
+  std::this_thread::sleep_for(ddp::Receiver::kIdleTimeout + 100ms);
+  {
+    auto lock = std::unique_lock(led->mutex);
+    assert(led->shown.logo == kDisplayed);
+  }
+  std::cout << "Handed the panel back" << std::endl;
+
+  close(fd);
+  onMain(main_scheduler, [&] {
+    receiver.reset();
+    renderer.reset();
+  });
+}
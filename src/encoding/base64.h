@@ -15,9 +15,9 @@ inline std::string encode(std::string_view buf) {
   auto it = buf.begin();
 
   for (std::size_t i = 0; i < buf.size() / 3; ++i) {
-    temp = (*it++) << 16;
-    temp += (*it++) << 8;
-    temp += (*it++);
+    temp = uint8_t(*it++) << 16;
+    temp += uint8_t(*it++) << 8;
+    temp += uint8_t(*it++);
     encoded.append(1, kChars[(temp & 0x00FC0000) >> 18]);
     encoded.append(1, kChars[(temp & 0x0003F000) >> 12]);
     encoded.append(1, kChars[(temp & 0x00000FC0) >> 6]);
@@ -26,14 +26,14 @@ inline std::string encode(std::string_view buf) {
 
   switch (buf.size() % 3) {
     case 1:
-      temp = (*it++) << 16;
+      temp = uint8_t(*it++) << 16;
       encoded.append(1, kChars[(temp & 0x00FC0000) >> 18]);
       encoded.append(1, kChars[(temp & 0x0003F000) >> 12]);
       encoded.append(2, '=');
       break;
     case 2:
-      temp = (*it++) << 16;
-      temp += (*it++) << 8;
+      temp = uint8_t(*it++) << 16;
+      temp += uint8_t(*it++) << 8;
       encoded.append(1, kChars[(temp & 0x00FC0000) >> 18]);
       encoded.append(1, kChars[(temp & 0x0003F000) >> 12]);
       encoded.append(1, kChars[(temp & 0x00000FC0) >> 6]);
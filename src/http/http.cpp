@@ -1,18 +1,47 @@
 #include "http.h"
 
 #include <curl/curl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <iostream>
+#include <mutex>
+#include <optional>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "http/util.h"
 
 namespace http {
 namespace {
 
-constexpr int64_t kMaxBufferSize = 16 * 1024;
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kMaxIdleHandles = 8;
+// Otherwise curl sizes its connection cache by the transfers in flight, and closes connections
+// that are about to be reused whenever there are only a few.
+constexpr long kMaxConnections = 16;
+constexpr uint64_t kStatsLogInterval = 100;
+
+constexpr auto kDefaultConnectTimeout = std::chrono::seconds{10};
+// Less than a byte per second for this long is taken for a stalled connection.
+constexpr auto kDefaultLowSpeedTime = std::chrono::seconds{30};
+
+// Hedging waits until there are enough samples for the percentile to mean something.
+constexpr size_t kLatencySamples = 64;
+constexpr size_t kMinHedgeSamples = 20;
+constexpr auto kHedgePercentile = 95;
+// Second attempts are paid for out of a budget that every hedged request adds to, so that they
+// stay a small share of requests however latencies shift. Starts out full.
+constexpr double kHedgeBudget = 0.1;
+constexpr double kMaxHedgeTokens = 10;
 
 void setMethod(CURL *curl, Method method) {
   switch (method) {
@@ -30,7 +59,8 @@ void setMethod(CURL *curl, Method method) {
       curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
       break;
     case Method::HEAD:
-      curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");
+      // Rather than a custom method, so that curl doesn't wait for a body.
+      curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
       break;
   }
 }
@@ -40,11 +70,119 @@ bool shouldUseTimeout(const Request &req) {
   return it == req.headers.end() || it->second != "keep-alive";
 }
 
-struct Buffer {
+// Scheme, host and port of the url.
+std::string origin(std::string_view url) {
+  auto host = url.find("://");
+  host = host == std::string_view::npos ? 0 : host + 3;
+  return std::string(url.substr(0, url.find('/', host)));
+}
+
+// Host and path of the url, which requests are timed by.
+std::string timingsKey(std::string_view url) {
+  if (auto scheme = url.find("://"); scheme != std::string_view::npos) {
+    url.remove_prefix(scheme + 3);
+  }
+  return std::string(url.substr(0, url.find_first_of("?#")));
+}
+
+std::chrono::microseconds elapsedSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+}
+
+// Times from request() until on_response of the latest responses from one origin, the same span
+// that a hedged request waits for.
+struct Latencies {
+  std::array<std::chrono::microseconds, kLatencySamples> samples;
+  size_t count = 0;
+
+  void add(std::chrono::microseconds sample) { samples[count++ % samples.size()] = sample; }
+
+  std::optional<std::chrono::microseconds> percentile(int p) const {
+    if (count < kMinHedgeSamples) {
+      return std::nullopt;
+    }
+    auto sorted = std::vector(samples.begin(), samples.begin() + std::min(count, samples.size()));
+    auto nth = sorted.begin() + (sorted.size() - 1) * p / 100;
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    return *nth;
+  }
+};
+
+// Ring of fixed size slots for streamed responses. curl fills the slots on the http thread while
+// the consumer holds on to the ones it was handed, and is only paused once all of them are held.
+struct Stream {
+  struct Slot {
+    int64_t offset = 0;
+    std::string data;
+    std::atomic_bool in_use = false;
+  };
+
+  Stream(size_t num_slots, size_t slot_size)
+      : slots(std::max<size_t>(num_slots, 1)), slot_size{slot_size} {
+    for (auto &slot : slots) {
+      slot.data.reserve(slot_size);
+    }
+  }
+
+  Slot &fillSlot() { return slots[num_filled % slots.size()]; }
+  bool hasPartialSlot() {
+    auto &slot = fillSlot();
+    return !slot.in_use && !slot.data.empty();
+  }
+
+  // Returns false if the next slot is still held. curl then pauses the transfer and passes the
+  // same data again once resumed, possibly split up differently, so the part that was already
+  // copied is skipped.
+  bool write(std::string_view chunk) {
+    auto written = std::min(skip, chunk.size());
+    skip -= written;
+    while (written < chunk.size()) {
+      auto &slot = fillSlot();
+      if (slot.in_use) {
+        paused = true;
+        // Checked again as the slot may have been released before |paused| was set.
+        if (slot.in_use) {
+          skip += written;
+          return false;
+        }
+        paused = false;
+      }
+      auto part = chunk.substr(written, slot_size - slot.data.size());
+      slot.data += part;
+      written += part.size();
+      if (slot.data.size() == slot_size) {
+        commit();
+      }
+    }
+    return true;
+  }
+
+  // Makes the slot being filled ready for the consumer.
+  void commit() {
+    auto &slot = fillSlot();
+    slot.offset = std::exchange(offset, offset + slot.data.size());
+    slot.in_use = true;
+    ++num_held;
+    num_ready = ++num_filled;
+  }
+
+  std::vector<Slot> slots;
+  const size_t slot_size;
+
+  // http thread
   int64_t offset = 0;
-  std::string data;
+  size_t num_filled = 0;
+  size_t num_announced = 0;
   size_t skip = 0;
-  bool is_processing = false;
+
+  std::atomic<size_t> num_ready = 0;
+  std::atomic<size_t> num_held = 0;
+  std::atomic_bool paused = false;
+  std::atomic_bool delivery_pending = false;
+  async::Lifetime resume_work;  // set by whoever releases the slot that unpauses the transfer
+
+  // on_bytes thread
+  size_t num_delivered = 0;
 };
 
 }  // namespace
@@ -58,15 +196,78 @@ Response::Response(std::string body) : status{200}, body{std::move(body)} {}
 Response::Response(int status, Headers headers, std::string body)
     : status{status}, headers{std::move(headers)}, body{std::move(body)} {}
 
+double Stats::reuseRate() const {
+  auto total = new_connections + reused_connections;
+  return total ? double(reused_connections) / total : 0;
+}
+
+std::chrono::microseconds Stats::handshakeTimeSaved() const {
+  if (!new_connections) {
+    return {};
+  }
+  return std::chrono::microseconds{handshake_time.count() * int64_t(reused_connections) /
+                                   int64_t(new_connections)};
+}
+
+int64_t Stats::bytesSaved() const { return int64_t(decoded_bytes) - int64_t(wire_bytes); }
+
+Timings &Stats::timingsFor(const std::string &key) {
+  if (auto it = timings.find(key); it != timings.end()) {
+    return it->second;
+  }
+  // Every proxied path and state would otherwise get an entry of its own, kept forever. The last
+  // slot is kept for kOtherTimingsKey, so the map never holds more than kMaxTimingsKeys.
+  if (timings.size() - timings.count(kOtherTimingsKey) + 1 < kMaxTimingsKeys) {
+    return timings[key];
+  }
+  return timings[kOtherTimingsKey];
+}
+
+void Histogram::add(std::chrono::microseconds duration) {
+  auto us = uint64_t(std::max<int64_t>(duration.count(), 0));
+  ++buckets[std::min<size_t>(std::bit_width(us), buckets.size() - 1)];
+  ++count;
+  sum += duration;
+  max = std::max(max, duration);
+}
+
+std::chrono::microseconds Histogram::mean() const {
+  return count ? sum / int64_t(count) : std::chrono::microseconds{};
+}
+
+std::chrono::microseconds Histogram::percentile(int p) const {
+  auto target = (count * p + 99) / 100;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    if ((seen += buckets[i]) >= target && seen) {
+      return std::min(std::chrono::microseconds{int64_t(1) << i}, max);
+    }
+  }
+  return max;
+}
+
 struct RequestState {
   RequestState(async::Scheduler &http_scheduler, Request &&request, RequestOptions &&opts)
-      : request{std::move(request)}, opts{std::move(opts)}, _http_scheduler{http_scheduler} {}
+      : request{std::move(request)},
+        opts{std::move(opts)},
+        timings_key{timingsKey(this->request.url)},
+        _http_scheduler{http_scheduler} {}
 
   Request request;
   RequestOptions opts;
   Response response;
   std::atomic_bool aborted = false;
-  std::shared_ptr<Buffer> buffer;
+  std::unique_ptr<Stream> stream;
+  bool decode_body = false;
+  int64_t decoded_bytes = 0;
+  std::string timings_key;
+  Clock::time_point requested_at = Clock::now();
+  std::chrono::microseconds queued = {};
+  Clock::time_point ready_at;
+  // Of the second attempt of a hedged request, the first one.
+  std::weak_ptr<RequestState> hedge_of;
+  CURL *curl = nullptr;
+  std::unique_ptr<curl_slist, decltype(&curl_slist_free_all)> headers{nullptr, curl_slist_free_all};
 
   void runOnHttp(async::Fn fn) { _http_work = _http_scheduler.schedule(std::move(fn)); }
   void runOnMain(async::Fn fn) { _main_work = opts.post_to.schedule(std::move(fn)); }
@@ -76,95 +277,226 @@ struct RequestState {
   async::Lifetime _main_work, _http_work;
 };
 
+class HttpImpl;
+
 class RequestHandle final {
  public:
-  RequestHandle(std::shared_ptr<CURLM> curlm, std::shared_ptr<RequestState> request)
-      : _curlm{std::move(curlm)}, _request{std::move(request)} {}
-  ~RequestHandle() {
-    _request->aborted = true;
-    if (auto curl = _curlm.lock()) {
-      curl_multi_wakeup(curl.get());
-    }
-  }
+  RequestHandle(std::shared_ptr<CURLM> curlm, HttpImpl &http, std::shared_ptr<RequestState> request)
+      : _curlm{std::move(curlm)}, _http{http}, _request{std::move(request)} {}
+  ~RequestHandle();
+
+  const std::shared_ptr<RequestState> &state() const { return _request; }
 
  private:
   std::weak_ptr<CURLM> _curlm;
+  HttpImpl &_http;
   std::shared_ptr<RequestState> _request;
 };
 
 class HttpImpl final : public Http {
  public:
-  explicit HttpImpl(CURLM *curlm)
-      : _curlm{curlm, [](auto curlm) { curl_multi_cleanup(curlm); }},
-        _thread{async::Thread::create("http")} {}
-  ~HttpImpl() { _thread.reset(); }
+  HttpImpl(CURLM *curlm, CURLSH *share)
+      : _share{share, [](auto share) { curl_share_cleanup(share); }},
+        _curlm{curlm, [](auto curlm) { curl_multi_cleanup(curlm); }},
+        _thread{async::PollThread::create("http")} {
+    curl_multi_setopt(curlm, CURLMOPT_SOCKETFUNCTION, onSocket);
+    curl_multi_setopt(curlm, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(curlm, CURLMOPT_TIMERFUNCTION, onTimer);
+    curl_multi_setopt(curlm, CURLMOPT_TIMERDATA, this);
+    curl_multi_setopt(curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(curlm, CURLMOPT_MAXCONNECTS, kMaxConnections);
+
+    // Handles are only ever used on the http thread, so the share needs no lock callbacks. The
+    // multi handle already keeps one connection cache for all of its transfers.
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  }
+  ~HttpImpl() {
+    _thread.reset();
+    for (auto &[curl, state] : _requests) {
+      curl_multi_remove_handle(_curlm.get(), curl);
+      curl_easy_cleanup(curl);
+    }
+    for (auto curl : _idle_handles) {
+      curl_easy_cleanup(curl);
+    }
+  }
 
   Lifetime request(Request request, RequestOptions opts) final {
+    if (opts.hedge && !opts.on_bytes) {
+      auto lock = std::unique_lock(_stats_mutex);
+      _hedge_tokens = std::min(_hedge_tokens + kHedgeBudget, kMaxHedgeTokens);
+      if (auto it = _latencies.find(origin(request.url)); it != _latencies.end()) {
+        if (auto delay = it->second.percentile(kHedgePercentile)) {
+          lock.unlock();
+          return hedgedRequest(std::move(request), std::move(opts), *delay);
+        }
+      }
+    }
+    return startRequest(std::move(request), std::move(opts), {});
+  }
+
+  Stats stats() final {
+    auto lock = std::unique_lock(_stats_mutex);
+    return _stats;
+  }
+
+  void abortRequest(std::shared_ptr<RequestState> state) {
+    if (auto curl = std::exchange(state->curl, nullptr)) {
+      curl_multi_remove_handle(_curlm.get(), curl);
+      releaseHandle(curl);
+      _requests.erase(curl);
+    }
+  }
+
+ private:
+  std::shared_ptr<RequestHandle> startRequest(Request request,
+                                             RequestOptions opts,
+                                             std::weak_ptr<RequestState> hedge_of) {
     auto state =
         std::make_shared<RequestState>(_thread->scheduler(), std::move(request), std::move(opts));
+    state->hedge_of = std::move(hedge_of);
 
     state->runOnHttp([this, state] { processNewRequest(state); });
 
-    curl_multi_wakeup(_curlm.get());
+    return std::make_shared<RequestHandle>(_curlm, *this, state);
+  }
 
-    return std::make_shared<RequestHandle>(_curlm, state);
+  Lifetime hedgedRequest(Request request, RequestOptions opts, std::chrono::microseconds delay) {
+    struct Hedge {
+      std::array<std::shared_ptr<RequestHandle>, 2> attempts;
+      int num_pending = 0;
+      async::Lifetime timer;
+      RequestOptions::OnResponse on_response;
+    };
+    auto hedge = std::make_shared<Hedge>();
+    hedge->on_response = std::move(opts.on_response);
+    opts.hedge = false;
+
+    auto send = [this, weak = std::weak_ptr(hedge), request, opts](size_t index) {
+      auto hedge = weak.lock();
+      if (!hedge) {
+        return;
+      }
+      auto attempt_opts = opts;
+      attempt_opts.on_response = [weak, index](Response res) {
+        auto hedge = weak.lock();
+        if (!hedge || !hedge->on_response) {
+          return;
+        }
+        // A failed attempt only counts if there's no other one left that could still succeed.
+        if (--hedge->num_pending && res.status >= 500) {
+          return;
+        }
+        hedge->timer.reset();
+        hedge->attempts[1 - index].reset();
+        std::exchange(hedge->on_response, {})(std::move(res));
+      };
+      ++hedge->num_pending;
+      auto first = index && hedge->attempts[0] ? hedge->attempts[0]->state() : nullptr;
+      hedge->attempts[index] = startRequest(request, std::move(attempt_opts), first);
+    };
+
+    send(0);
+    hedge->timer = opts.post_to.schedule(
+        [this, send] {
+          {
+            auto lock = std::unique_lock(_stats_mutex);
+            if (_hedge_tokens < 1) {
+              return;
+            }
+            _hedge_tokens -= 1;
+            ++_stats.hedges;
+          }
+          send(1);
+        },
+        {.delay = delay});
+    return hedge;
   }
 
- private:
   void processNewRequest(std::shared_ptr<RequestState> state) {
     if (state->aborted) {
       return;
     }
+    state->queued = elapsedSince(state->requested_at);
+    // Adding the handle arms the timer, which gets the transfer going.
     setupRequest(std::move(state));
-    process();
-  }
-
-  void process() {
-    for (auto it = _requests.begin(); it != _requests.end();) {
-      auto &[curl, state] = *it;
-      if (state->aborted) {
-        curl_multi_remove_handle(_curlm.get(), curl);
-        curl_easy_cleanup(curl);
-        it = _requests.erase(it);
-      } else {
-        ++it;
-      }
+  }
+
+  static int onSocket(CURL *, curl_socket_t fd, int what, void *obj, void *) {
+    auto self = static_cast<HttpImpl *>(obj);
+    if (!self->_thread) {
+      return 0;
+    }
+    if (what == CURL_POLL_REMOVE) {
+      self->_thread->unwatch(fd);
+      return 0;
     }
+    short events = (what & CURL_POLL_IN ? POLLIN : 0) | (what & CURL_POLL_OUT ? POLLOUT : 0);
+    self->_thread->watch(fd, events, [self, fd](short revents) {
+      auto flags = (revents & (POLLIN | POLLHUP) ? CURL_CSELECT_IN : 0) |
+                   (revents & POLLOUT ? CURL_CSELECT_OUT : 0) |
+                   (revents & (POLLERR | POLLNVAL) ? CURL_CSELECT_ERR : 0);
+      self->socketAction(fd, flags);
+    });
+    return 0;
+  }
+
+  static int onTimer(CURLM *, long timeout_ms, void *obj) {
+    auto self = static_cast<HttpImpl *>(obj);
+    self->_timer = timeout_ms >= 0 && self->_thread
+                       ? self->_thread->scheduler().schedule(
+                             [self] { self->socketAction(CURL_SOCKET_TIMEOUT, 0); },
+                             {.delay = std::chrono::milliseconds{timeout_ms}})
+                       : nullptr;
+    return 0;
+  }
 
+  void socketAction(curl_socket_t fd, int flags) {
     int still_running = 0;
-    auto err = curl_multi_perform(_curlm.get(), &still_running);
+    if (auto err = curl_multi_socket_action(_curlm.get(), fd, flags, &still_running)) {
+      std::cerr << "curl failed: " << curl_multi_strerror(err) << std::endl;
+      return;
+    }
+    processTransfers();
+  }
 
+  void processTransfers() {
     int msgq = 0;
     while (auto info = curl_multi_info_read(_curlm.get(), &msgq)) {
       if (info->msg == CURLMSG_DONE) {
-        finishRequest(info->easy_handle, info->data.result,
-                      std::move(_requests[info->easy_handle]));
-        _requests.erase(info->easy_handle);
+        auto curl = info->easy_handle;
+        auto result = info->data.result;
+        finishRequest(curl, result, std::move(_requests[curl]));
+        _requests.erase(curl);
       }
     }
-
-    if (!err) {
-      for (auto &[curl, state] : _requests) {
-        if (state->buffer) {
-          processStream(curl, state, *state->buffer);
-        }
-      }
-      if (still_running) {
-        err = curl_multi_poll(_curlm.get(), nullptr, 0, 1000, NULL);
+    for (auto &[curl, state] : _requests) {
+      if (state->stream) {
+        processStream(state);
       }
     }
+  }
 
-    if (err) {
-      std::cerr << "curl failed: " << curl_multi_strerror(err) << std::endl;
-      return;
+  CURL *acquireHandle() {
+    if (_idle_handles.empty()) {
+      return curl_easy_init();
     }
+    auto curl = _idle_handles.back();
+    _idle_handles.pop_back();
+    return curl;
+  }
 
-    _work =
-        still_running && _thread ? _thread->scheduler().schedule([this] { process(); }) : nullptr;
+  void releaseHandle(CURL *curl) {
+    if (_idle_handles.size() == kMaxIdleHandles) {
+      return curl_easy_cleanup(curl);
+    }
+    curl_easy_reset(curl);
+    _idle_handles.push_back(curl);
   }
 
   void setupRequest(std::shared_ptr<RequestState> state) {
-    auto curl = curl_easy_init();
+    auto curl = acquireHandle();
 
     if (!curl) {
       return state->runOnMain([state] {
@@ -174,17 +506,41 @@ class HttpImpl final : public Http {
       });
     }
     curl_easy_setopt(curl, CURLOPT_URL, state->request.url.c_str());
-    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    curl_easy_setopt(curl, CURLOPT_SHARE, _share.get());
+    // Multiplexes requests to the same host over one TLS connection, rather than opening another
+    // connection while the first one is still busy.
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    if (state->opts.fresh_connection || isStalled(state->hedge_of.lock())) {
+      curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1L);
+    } else if (state->request.url.starts_with("https:")) {
+      // Plain http stays on HTTP/1.1, where waiting for a busy connection only holds requests up.
+      curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    setTimeouts(curl, *state);
 
     setMethod(curl, state->request.method);
 
-    curl_slist *headers = nullptr;
     for (auto &[key, val] : state->request.headers) {
-      auto new_headers = curl_slist_append(headers, (key + ": " + val).c_str());
-      headers = new_headers ? new_headers : (curl_slist_free_all(headers), nullptr);
+      auto headers = curl_slist_append(state->headers.get(), (key + ": " + val).c_str());
+      if (!headers) {
+        state->headers.reset();
+        break;
+      }
+      state->headers.release();
+      state->headers.reset(headers);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, state->headers.get());
+
+    // Unless the caller asked for an encoding itself, let curl negotiate one and decode the body
+    // as it arrives. Otherwise the body is passed on as it was sent.
+    state->decode_body = !state->request.headers.contains("accept-encoding");
+    if (state->decode_body) {
+      curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    } else {
+      curl_easy_setopt(curl, CURLOPT_HTTP_CONTENT_DECODING, 0L);
     }
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
     if (!state->request.body.empty()) {
       curl_easy_setopt(curl, CURLOPT_POSTFIELDS, state->request.body.c_str());
@@ -198,70 +554,232 @@ class HttpImpl final : public Http {
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, state.get());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, onBytes);
 
-    curl_multi_add_handle(_curlm.get(), curl);
+    if (auto &opts = state->opts; opts.on_bytes && opts.always_stream) {
+      state->stream = std::make_unique<Stream>(opts.stream_slots, opts.stream_slot_size);
+    }
 
+    state->curl = curl;
     _requests[curl] = state;
+
+    curl_multi_add_handle(_curlm.get(), curl);
   }
 
-  void processStream(CURL *curl, std::shared_ptr<RequestState> &state, Buffer &buffer) {
-    if (buffer.is_processing || buffer.data.size() < kMaxBufferSize) {
+  // Whether the connection of a transfer no longer gets what is sent on it across, with some of it
+  // still unacknowledged. A server that is merely slow to answer is better waited for on the
+  // connections that are open, or alongside on the same one.
+  static bool isStalled(const std::shared_ptr<RequestState> &state) {
+    auto fd = curl_socket_t(CURL_SOCKET_BAD);
+    if (!state || !state->curl ||
+        curl_easy_getinfo(state->curl, CURLINFO_ACTIVESOCKET, &fd) != CURLE_OK ||
+        fd == CURL_SOCKET_BAD) {
+      return false;
+    }
+    auto info = tcp_info{};
+    auto len = socklen_t(sizeof(info));
+    return getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 &&
+           (info.tcpi_unacked || info.tcpi_retransmits);
+  }
+
+  static void setTimeouts(CURL *curl, const RequestState &state) {
+    auto &opts = state.opts;
+    if (opts.timeout.count()) {
+      curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, long(opts.timeout.count()));
+    }
+    auto connect_timeout =
+        opts.connect_timeout.count() ? opts.connect_timeout : kDefaultConnectTimeout;
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, long(connect_timeout.count()));
+
+    // Otherwise a connection that stalls holds on to the request, and whoever waits for it, for
+    // as long as the OS keeps it open.
+    if (opts.low_speed_time.count()) {
+      auto limit = std::max<int64_t>(opts.low_speed_limit, 1);
+      curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, long(limit));
+      curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, long(opts.low_speed_time.count()));
+    } else if (!opts.always_stream && shouldUseTimeout(state.request)) {
+      curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+      curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, long(kDefaultLowSpeedTime.count()));
+    }
+  }
+
+  void processStream(const std::shared_ptr<RequestState> &state) {
+    auto &stream = *state->stream;
+    // Rather than leaving the consumer idle until a slot fills up, hand over what there is.
+    if (!stream.num_held && stream.hasPartialSlot()) {
+      stream.commit();
+    }
+    if (stream.num_announced == stream.num_filled) {
       return;
     }
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &state->response.status);
-    buffer.is_processing = true;
+    auto is_first = !stream.num_announced;
+    if (is_first) {
+      curl_easy_getinfo(state->curl, CURLINFO_RESPONSE_CODE, &state->response.status);
+      stripContentEncoding(*state);
+      state->ready_at = Clock::now();
+    }
+    stream.num_announced = stream.num_filled;
+    if (state->opts.bytes_on_http_thread) {
+      if (is_first) {
+        state->runOnMain([this, state] { deliver(state); });
+      }
+      return deliverBytes(state);
+    }
+    if (!stream.delivery_pending.exchange(true)) {
+      state->runOnMain([this, state] { deliver(state); });
+    }
+  }
 
-    state->runOnMain([this, curl, state] {
-      triggerCallbacks(*state, /* skip_empty */ false, [this, curl, state] {
-        state->runOnHttp([this, curl, state] { continueRequest(curl, state); });
-        curl_multi_wakeup(_curlm.get());
-      });
-    });
+  // Any thread
+  void releaseSlot(const std::shared_ptr<RequestState> &state, Stream::Slot &slot) {
+    auto &stream = *state->stream;
+    slot.data.clear();
+    slot.in_use = false;
+    --stream.num_held;
+    if (stream.paused.exchange(false)) {
+      stream.resume_work = _thread->scheduler().schedule([this, state] { resumeStream(state); });
+    }
   }
 
-  void continueRequest(CURL *curl, std::shared_ptr<RequestState> state) {
-    if (state->aborted) {
+  void resumeStream(const std::shared_ptr<RequestState> &state) {
+    if (state->aborted || !state->curl) {
       return;
     }
-    state->buffer->offset += state->buffer->data.size();
-    state->buffer->data.clear();
-    state->buffer->is_processing = false;
-    curl_easy_pause(curl, CURLPAUSE_CONT);
-    process();
+    // Resuming writes out what curl held back while paused.
+    curl_easy_pause(state->curl, CURLPAUSE_CONT);
+    processTransfers();
   }
 
   void finishRequest(CURL *curl, CURLcode code, std::shared_ptr<RequestState> state) {
     if (code == CURLE_OK) {
       curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &state->response.status);
+    } else if (code == CURLE_OPERATION_TIMEDOUT) {
+      std::cerr << "curl timed out: " << state->request.url << std::endl;
+      state->response.status = 504;
     } else {
       std::cerr << "curl failed: " << curl_easy_strerror(code) << std::endl;
     }
+    if (!state->stream || !state->stream->num_announced) {
+      stripContentEncoding(*state);
+      state->ready_at = Clock::now();
+    }
+    state->curl = nullptr;
     curl_multi_remove_handle(_curlm.get(), curl);
-    curl_easy_cleanup(curl);
+    updateStats(curl, code, *state);
+    releaseHandle(curl);
 
-    state->runOnMain([state] { triggerCallbacks(*state, /* skip_empty */ true, [state] {}); });
+    if (auto &stream = state->stream) {
+      if (stream->hasPartialSlot()) {
+        stream->commit();
+      }
+      if (state->opts.bytes_on_http_thread) {
+        deliverBytes(state);
+      }
+    }
+    state->runOnMain([this, state] {
+      deliver(state);
+      if (auto on_done = state->opts.on_done; on_done && !state->aborted) {
+        on_done();
+      }
+    });
   }
 
-  static void triggerCallbacks(RequestState &state, bool skip_empty, std::function<void()> next) {
-    if (state.aborted) {
-      return;
+  // The body no longer matches these once curl has decoded it.
+  static void stripContentEncoding(RequestState &state) {
+    auto &headers = state.response.headers;
+    if (state.decode_body && headers.erase("content-encoding") && headers.erase("content-length") &&
+        state.stream) {
+      // The decoded length of a streamed body isn't known until it's over.
+      headers["transfer-encoding"] = "chunked";
     }
-    if (auto on_response = std::exchange(state.opts.on_response, {})) {
-      on_response(std::move(state.response));
+  }
+
+  void updateStats(CURL *curl, CURLcode code, const RequestState &state) {
+    long num_connects = 0;
+    // Each counted from the start of the transfer.
+    curl_off_t name_lookup_time = 0, connect_time = 0, appconnect_time = 0, pretransfer_time = 0,
+               first_byte_time = 0, total_time = 0, wire_bytes = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &num_connects);
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &name_lookup_time);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect_time);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect_time);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer_time);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte_time);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_time);
+    // Counted before curl decodes the body.
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &wire_bytes);
+
+    auto lock = std::unique_lock(_stats_mutex);
+    ++_stats.requests;
+    _stats.wire_bytes += wire_bytes;
+    _stats.decoded_bytes += state.decoded_bytes;
+    if (num_connects) {
+      _stats.new_connections += num_connects;
+      _stats.handshake_time += std::chrono::microseconds{std::max(connect_time, appconnect_time)};
+    } else {
+      ++_stats.reused_connections;
     }
-    if (state.aborted) {
+    if (code == CURLE_OK) {
+      using us = std::chrono::microseconds;
+      auto &timings = _stats.timingsFor(state.timings_key);
+      timings.queued.add(state.queued);
+      if (num_connects) {
+        timings.name_lookup.add(us{name_lookup_time});
+        timings.connect.add(us{connect_time - name_lookup_time});
+        if (appconnect_time) {
+          timings.tls_handshake.add(us{appconnect_time - connect_time});
+        }
+      }
+      timings.wait.add(us{first_byte_time - pretransfer_time});
+      timings.receive.add(us{total_time - first_byte_time});
+      timings.total.add(us{total_time});
+    } else if (code == CURLE_OPERATION_TIMEDOUT) {
+      ++_stats.timeouts;
+    }
+    if (_stats.requests % kStatsLogInterval == 0) {
+      std::cout << "http: " << _stats.requests << " requests, "
+                << int(_stats.reuseRate() * 100) << "% on reused connections, saved ~"
+                << _stats.handshakeTimeSaved().count() / 1000 << "ms of handshakes, "
+                << _stats.bytesSaved() / 1024 << "KiB by compression, " << _stats.timeouts
+                << " timed out, " << _stats.hedges << " hedged" << std::endl;
+    }
+  }
+
+  // Main thread
+  void deliver(const std::shared_ptr<RequestState> &state) {
+    if (state->aborted) {
       return;
     }
-    if (auto &buffer = state.buffer) {
-      if (auto on_bytes = state.opts.on_bytes; on_bytes && (!skip_empty || !buffer->data.empty())) {
-        struct BufferHandle {
-          BufferHandle(std::function<void()> next) : next{std::move(next)} {}
-          ~BufferHandle() { next(); }
-          std::function<void()> next;
-        };
-        on_bytes(buffer->offset, buffer->data, std::make_shared<BufferHandle>(std::move(next)));
-      } else {
-        next();
+    if (auto on_response = std::exchange(state->opts.on_response, {})) {
+      {
+        auto lock = std::unique_lock(_stats_mutex);
+        _stats.timingsFor(state->timings_key).delivery.add(elapsedSince(state->ready_at));
+        // Timeouts and failures to connect don't say how long a response takes. A second attempt
+        // that answers a hedged request does so as of the first one.
+        if (auto status = state->response.status; status && status != 504) {
+          auto first = state->hedge_of.lock();
+          _latencies[origin(state->request.url)].add(
+              elapsedSince((first ? *first : *state).requested_at));
+        }
       }
+      on_response(std::move(state->response));
+    }
+    if (state->stream && !state->opts.bytes_on_http_thread) {
+      state->stream->delivery_pending = false;
+      deliverBytes(state);
+    }
+  }
+
+  void deliverBytes(const std::shared_ptr<RequestState> &state) {
+    auto &stream = state->stream;
+    struct SlotHandle {
+      SlotHandle(std::function<void()> release) : release{std::move(release)} {}
+      ~SlotHandle() { release(); }
+      std::function<void()> release;
+    };
+    for (auto num_ready = stream->num_ready.load();
+         !state->aborted && stream->num_delivered < num_ready; ++stream->num_delivered) {
+      auto &slot = stream->slots[stream->num_delivered % stream->slots.size()];
+      auto release = [this, state, &slot] { releaseSlot(state, slot); };
+      state->opts.on_bytes(slot.offset, slot.data, std::make_shared<SlotHandle>(release));
     }
   }
 
@@ -277,13 +795,18 @@ class HttpImpl final : public Http {
     std::transform(key.begin(), key.end(), key.begin(), ::tolower);
 
     if (key == "content-length") {
+      auto &opts = state->opts;
       if (auto content_length = std::stoll(value);
-          content_length < kMaxBufferSize || !state->opts.on_bytes) {
+          content_length < int64_t(opts.stream_slot_size) || !opts.on_bytes) {
         state->response.body.reserve(content_length);
-      } else {
-        state->buffer = std::make_unique<Buffer>();
-        state->buffer->data.reserve(kMaxBufferSize);
+      } else if (!state->stream) {
+        state->stream = std::make_unique<Stream>(opts.stream_slots, opts.stream_slot_size);
       }
+    } else if (key == "transfer-encoding" && value.find("chunked") != std::string::npos &&
+               state->opts.on_bytes && !state->stream) {
+      // Of unknown length, so passed on as it arrives rather than held until it's over.
+      auto &opts = state->opts;
+      state->stream = std::make_unique<Stream>(opts.stream_slots, opts.stream_slot_size);
     }
 
     state->response.headers[std::move(key)] = std::move(value);
@@ -295,31 +818,45 @@ class HttpImpl final : public Http {
     size *= nmemb;
     auto chunk = std::string_view(ptr, size);
 
-    if (auto &buffer = state->buffer) {
-      if (buffer->data.size() + size > kMaxBufferSize) {
-        auto overflow = buffer->data.size() + size - kMaxBufferSize;
-        auto partial = chunk.substr(0, chunk.size() - overflow);
-        buffer->data += partial;
-        buffer->skip = partial.size();
-        return CURL_WRITEFUNC_PAUSE;
-      }
-      buffer->data += chunk.substr(std::exchange(buffer->skip, 0));
-    } else {
+    if (auto &stream = state->stream; stream && !stream->write(chunk)) {
+      return CURL_WRITEFUNC_PAUSE;
+    } else if (!stream) {
       state->response.body += chunk;
     }
-
+    state->decoded_bytes += size;
     return size;
   }
 
+  // Destroyed last, as the easy handles still refer to it until they're cleaned up.
+  std::unique_ptr<CURLSH, void (*)(CURLSH *)> _share;
   std::shared_ptr<CURLM> _curlm;
-  std::unique_ptr<async::Thread> _thread;
+  std::unique_ptr<async::PollThread> _thread;
   std::unordered_map<CURL *, std::shared_ptr<RequestState>> _requests;
-  async::Lifetime _work;
+  std::vector<CURL *> _idle_handles;
+  async::Lifetime _timer;
+
+  std::mutex _stats_mutex;
+  Stats _stats;
+  std::unordered_map<std::string, Latencies> _latencies;
+  double _hedge_tokens = kMaxHedgeTokens;
 };
 
+RequestHandle::~RequestHandle() {
+  _request->aborted = true;
+  if (_curlm.lock()) {
+    _request->runOnHttp([&http = _http, request = _request] { http.abortRequest(request); });
+  }
+}
+
 std::unique_ptr<Http> Http::create() {
   auto curlm = curl_multi_init();
-  return curlm ? std::make_unique<HttpImpl>(curlm) : nullptr;
+  auto share = curl_share_init();
+  if (!curlm || !share) {
+    curl_multi_cleanup(curlm);
+    curl_share_cleanup(share);
+    return nullptr;
+  }
+  return std::make_unique<HttpImpl>(curlm, share);
 }
 
 }  // namespace http
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <map>
 #include <string>
 #include <unordered_map>
 
@@ -42,15 +45,105 @@ struct Response {
 struct RequestOptions {
   using OnResponse = std::function<void(Response)>;
   using OnBytes = std::function<void(int64_t offset, std::string_view, Lifetime)>;
+  using OnDone = std::function<void()>;
 
   async::Scheduler &post_to;
   OnResponse on_response;
   OnBytes on_bytes;
+  // Called on post_to once the transfer is over, after the last call to on_bytes.
+  OnDone on_done;
+
+  // Responses of at least stream_slot_size bytes, or of unknown length, are passed to on_bytes in
+  // chunks of that size. A response of unknown length has a transfer-encoding header.
+  // Up to stream_slots chunks can be held at once before the transfer is paused.
+  size_t stream_slots = 4;
+  size_t stream_slot_size = 16 * 1024;
+  // Calls on_bytes right on the http thread rather than on post_to, possibly before on_response.
+  // Saves a thread hop per chunk for consumers that pass the data on to another thread anyway.
+  bool bytes_on_http_thread = false;
+  // Streams responses of unknown or small size as well, e.g. server-sent events.
+  bool always_stream = false;
+
+  // Gives up on the transfer once it has taken timeout in total, or connecting alone has taken
+  // connect_timeout. Giving up is reported as a 504. No timeout means none, and no connect
+  // timeout means a default one.
+  std::chrono::milliseconds timeout = {};
+  std::chrono::milliseconds connect_timeout = {};
+  // Gives up once the transfer has stayed below low_speed_limit bytes per second for
+  // low_speed_time. Unless set, stalled transfers are given up on after a while, except streams
+  // and requests for a connection that is kept alive.
+  int64_t low_speed_limit = 0;
+  std::chrono::seconds low_speed_time = {};
+
+  // Sends the request a second time if there's no response within the 95th percentile of the
+  // latencies seen for its host, and passes on whichever response arrives first. Second attempts
+  // are capped at about a tenth of hedged requests, and only get a fresh connection if the one of
+  // the first attempt has stalled. Only for idempotent requests, and ignored for streamed ones.
+  bool hedge = false;
+  // Opens a new connection rather than waiting for or reusing an open one, which may be stalled.
+  bool fresh_connection = false;
+};
+
+// Counts of durations in buckets that double in size, from under 2us to over an hour.
+struct Histogram {
+  std::array<uint64_t, 32> buckets = {};
+  uint64_t count = 0;
+  std::chrono::microseconds sum = {};
+  std::chrono::microseconds max = {};
+
+  void add(std::chrono::microseconds);
+  std::chrono::microseconds mean() const;
+  // Upper bound of the bucket the percentile falls in.
+  std::chrono::microseconds percentile(int) const;
+};
+
+// Where the time of the requests to one host and path went. The handshake phases only count
+// transfers that opened a connection.
+struct Timings {
+  // From the call to request() until the transfer was started on the http thread.
+  Histogram queued;
+  Histogram name_lookup;
+  Histogram connect;
+  Histogram tls_handshake;
+  // From sending the request until the first byte of the response, mostly server time.
+  Histogram wait;
+  // From the first to the last byte of the response.
+  Histogram receive;
+  Histogram total;
+  // From the response being ready until on_response was called on post_to.
+  Histogram delivery;
+};
+
+struct Stats {
+  uint64_t requests = 0;
+  // Transfers that had to open a connection, and the time spent on DNS, connect and TLS for them.
+  uint64_t new_connections = 0;
+  std::chrono::microseconds handshake_time = {};
+  // Transfers that went out on an already open connection.
+  uint64_t reused_connections = 0;
+  // Response body bytes as received, and after curl decoded any content encoding.
+  uint64_t wire_bytes = 0;
+  uint64_t decoded_bytes = 0;
+  // Transfers given up on for taking too long, and second attempts sent by hedged requests.
+  uint64_t timeouts = 0;
+  uint64_t hedges = 0;
+  // By host and path, without the query, for the first kMaxTimingsKeys - 1 of them. Requests to
+  // any others are timed together under kOtherTimingsKey.
+  static constexpr size_t kMaxTimingsKeys = 16;
+  static constexpr const char *kOtherTimingsKey = "other";
+  std::map<std::string, Timings> timings;
+
+  double reuseRate() const;
+  // Estimated from the average handshake of the connections that were opened.
+  std::chrono::microseconds handshakeTimeSaved() const;
+  int64_t bytesSaved() const;
+  Timings &timingsFor(const std::string &key);
 };
 
 struct Http {
   virtual ~Http() = default;
   virtual Lifetime request(Request, RequestOptions) = 0;
+  virtual Stats stats() = 0;
 
   static std::unique_ptr<Http> create();
 };
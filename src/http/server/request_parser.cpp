@@ -0,0 +1,219 @@
+#include "request_parser.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+
+namespace http {
+namespace {
+
+Method methodFromString(std::string_view str) {
+  auto is = [str](std::string_view method) {
+    return std::equal(str.begin(), str.end(), method.begin(), method.end(),
+                      [](auto lhs, auto rhs) { return std::toupper(lhs) == rhs; });
+  };
+  if (is("GET")) {
+    return Method::GET;
+  } else if (is("POST")) {
+    return Method::POST;
+  } else if (is("PUT")) {
+    return Method::PUT;
+  } else if (is("DELETE")) {
+    return Method::DELETE;
+  } else if (is("HEAD")) {
+    return Method::HEAD;
+  } else if (is("OPTIONS")) {
+    return Method::OPTIONS;
+  }
+  return Method::UNKNOWN;
+}
+
+std::string_view trimWhitespace(std::string_view str) {
+  auto begin = str.find_first_not_of(" \t");
+  if (begin == std::string_view::npos) {
+    return {};
+  }
+  return str.substr(begin, str.find_last_not_of(" \t") + 1 - begin);
+}
+
+bool equalsLowerCase(std::string_view str, std::string_view lower_case) {
+  return std::equal(str.begin(), str.end(), lower_case.begin(), lower_case.end(),
+                    [](auto lhs, auto rhs) { return std::tolower(lhs) == rhs; });
+}
+
+}  // namespace
+
+std::span<char> RequestParser::readBuffer() {
+  dropTakenBody();
+  // A body that doesn't fit after the headers is read into a buffer of its own.
+  if (_state == State::kBody && !_stream_body && _large_body.empty() &&
+      _content_length > _buffer.size() - _body_start) {
+    _large_body.resize(_content_length);
+    _large_body_size = _size - _body_start;
+    std::memcpy(_large_body.data(), _buffer.data() + _body_start, _large_body_size);
+    _size = _body_start;
+  }
+  if (!_large_body.empty()) {
+    return std::span(_large_body).subspan(_large_body_size);
+  }
+  return std::span(_buffer).subspan(_size);
+}
+
+RequestParser::Status RequestParser::parse(size_t num_read) {
+  dropTakenBody();
+  if (_state == State::kBody) {
+    (_large_body.empty() ? _size : _large_body_size) += num_read;
+    return bodyStatus();
+  }
+  if (_state == State::kComplete) {
+    return Status::kComplete;
+  }
+  _size += num_read;
+
+  for (;;) {
+    auto *begin = _buffer.data();
+    auto *end = std::find(begin + _scanned, begin + _size, '\n');
+    if (end == begin + _size) {
+      _scanned = _size;
+      // Out of room for the request line and headers.
+      return _size == _buffer.size() ? Status::kHeadTooLarge : Status::kIncomplete;
+    }
+    auto line = std::span(begin + _line_start, end);
+    if (!line.empty() && line.back() == '\r') {
+      line = line.first(line.size() - 1);
+    }
+    _scanned = _line_start = end - begin + 1;
+
+    if (_state == State::kRequestLine) {
+      // Clients may send a line break after the body of the previous request.
+      if (!line.empty() && !parseRequestLine({line.data(), line.size()})) {
+        return Status::kError;
+      }
+      _state = line.empty() ? State::kRequestLine : State::kHeaders;
+    } else if (line.empty()) {
+      _state = State::kBody;
+      _body_start = _line_start;
+      for (auto &[name, value] : headers()) {
+        if (name == "content-length" &&
+            std::from_chars(value.data(), value.data() + value.size(), _content_length).ec !=
+                std::errc{}) {
+          return Status::kError;
+        }
+      }
+      return bodyStatus();
+    } else if (_num_headers == _headers.size()) {
+      return Status::kHeadTooLarge;
+    } else if (!parseHeader(line)) {
+      return Status::kError;
+    }
+  }
+}
+
+RequestParser::Status RequestParser::bodyStatus() {
+  auto num_buffered = _large_body.empty() ? _size - _body_start : _large_body_size;
+  if (_body_taken + num_buffered < _content_length) {
+    return Status::kIncomplete;
+  }
+  _state = State::kComplete;
+  return Status::kComplete;
+}
+
+std::string_view RequestParser::takeBody() {
+  dropTakenBody();
+  _num_taken = std::min(_size - _body_start, _content_length - _body_taken);
+  _body_taken += _num_taken;
+  if (_body_taken == _content_length) {
+    _state = State::kComplete;
+  }
+  return {_buffer.data() + _body_start, _num_taken};
+}
+
+void RequestParser::dropTakenBody() {
+  if (!_num_taken) {
+    return;
+  }
+  auto *body = _buffer.data() + _body_start;
+  std::memmove(body, body + _num_taken, _size - _body_start - _num_taken);
+  _size -= _num_taken;
+  _num_taken = 0;
+}
+
+void RequestParser::next() {
+  dropTakenBody();
+  auto consumed =
+      _large_body.empty() ? _body_start + _content_length - _body_taken : _body_start;
+  std::memmove(_buffer.data(), _buffer.data() + consumed, _size - consumed);
+  _size -= consumed;
+  _scanned = _line_start = 0;
+
+  _state = State::kRequestLine;
+  _method = Method::UNKNOWN;
+  _url = {};
+  _http_1_1 = false;
+  _num_headers = 0;
+  _connection = {};
+  _body_start = _content_length = 0;
+  _large_body = {};
+  _large_body_size = 0;
+  _stream_body = false;
+  _body_taken = 0;
+}
+
+std::string_view RequestParser::body() const {
+  if (_stream_body) {
+    return {};
+  }
+  if (!_large_body.empty()) {
+    return _large_body;
+  }
+  return {_buffer.data() + _body_start, _content_length};
+}
+
+bool RequestParser::keepAlive() const {
+  return _http_1_1 ? !equalsLowerCase(_connection, "close")
+                   : equalsLowerCase(_connection, "keep-alive");
+}
+
+Request RequestParser::request() const {
+  auto req = Request{.method = _method, .url = std::string(_url), .body = std::string(body())};
+  req.headers.reserve(_num_headers);
+  for (auto &[name, value] : headers()) {
+    req.headers.insert_or_assign(std::string(name), std::string(value));
+  }
+  return req;
+}
+
+bool RequestParser::parseRequestLine(std::string_view line) {
+  auto method_end = line.find(' ');
+  auto url_end = line.find(' ', method_end + 1);
+  if (method_end == std::string_view::npos || url_end == std::string_view::npos) {
+    return false;
+  }
+  auto version = line.substr(url_end + 1);
+  if (!version.starts_with("HTTP/1.")) {
+    return false;
+  }
+  _method = methodFromString(line.substr(0, method_end));
+  _url = line.substr(method_end + 1, url_end - method_end - 1);
+  _http_1_1 = version != "HTTP/1.0";
+  return true;
+}
+
+bool RequestParser::parseHeader(std::span<char> line) {
+  auto colon = std::find(line.begin(), line.end(), ':');
+  if (colon == line.begin() || colon == line.end()) {
+    return false;
+  }
+  // In place, so that names can be compared as they are.
+  std::transform(line.begin(), colon, line.begin(), [](char c) { return char(std::tolower(c)); });
+  auto &header = _headers[_num_headers++];
+  header.name = {line.data(), size_t(colon - line.begin())};
+  header.value = trimWhitespace({&*colon + 1, size_t(line.end() - colon - 1)});
+  if (header.name == "connection") {
+    _connection = header.value;
+  }
+  return true;
+}
+
+}  // namespace http
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <http/http.h>
+
+#include <array>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace http {
+
+// Incremental parser for the requests on one connection. Input is read straight into a fixed
+// buffer, and parsed one line at a time as lines complete, so that it may be split anywhere. The
+// parts of a request are views into that buffer, until next() moves on to the following request.
+class RequestParser final {
+ public:
+  static constexpr size_t kBufferSize = 16 * 1024;
+  static constexpr size_t kMaxHeaders = 64;
+
+  enum class Status {
+    kIncomplete,
+    kComplete,
+    kError,
+    // The request line and headers don't fit the buffer, or there are too many headers.
+    kHeadTooLarge,
+  };
+
+  struct Header {
+    std::string_view name;  // lower case
+    std::string_view value;
+  };
+
+  // Where to read more input into. Empty if the request doesn't fit.
+  std::span<char> readBuffer();
+  // Parses on, after |num_read| bytes were read into readBuffer().
+  Status parse(size_t num_read);
+  // Drops the parsed request, keeping what was read of the following one.
+  void next();
+
+  // Whether the request line and headers are in, and the parts below valid.
+  bool headComplete() const { return _state == State::kBody || _state == State::kComplete; }
+  size_t contentLength() const { return _content_length; }
+  // Whether anything of a request has been read yet.
+  bool hasInput() const { return _size > 0 || _state != State::kRequestLine; }
+  // Hands out the body in pieces through takeBody() rather than collecting it for body(). Call
+  // once the head is complete.
+  void streamBody() { _stream_body = true; }
+  // The part of a streamed body read so far. Valid until the next call to the parser, which
+  // reuses its space.
+  std::string_view takeBody();
+
+  // Valid once parse() returned kComplete, until next().
+  Method method() const { return _method; }
+  std::string_view url() const { return _url; }
+  std::span<const Header> headers() const { return {_headers.data(), _num_headers}; }
+  std::string_view body() const;
+  // Whether the connection stays open after the response.
+  bool keepAlive() const;
+  bool isHttp11() const { return _http_1_1; }
+  Request request() const;
+
+ private:
+  enum class State {
+    kRequestLine,
+    kHeaders,
+    kBody,
+    kComplete,
+  };
+
+  bool parseRequestLine(std::string_view);
+  bool parseHeader(std::span<char>);
+  Status bodyStatus();
+  void dropTakenBody();
+
+  std::array<char, kBufferSize> _buffer;
+  // Bytes read, bytes looked at for line breaks, and the start of the line being parsed.
+  size_t _size = 0;
+  size_t _scanned = 0;
+  size_t _line_start = 0;
+
+  State _state = State::kRequestLine;
+  Method _method = Method::UNKNOWN;
+  std::string_view _url;
+  bool _http_1_1 = false;
+  std::array<Header, kMaxHeaders> _headers;
+  size_t _num_headers = 0;
+  std::string_view _connection;
+
+  // The body is kept in the buffer after the headers, unless it doesn't fit.
+  size_t _body_start = 0;
+  size_t _content_length = 0;
+  std::string _large_body;
+  size_t _large_body_size = 0;
+  // Of a streamed body, the bytes handed out in total, and those still in the buffer.
+  bool _stream_body = false;
+  size_t _body_taken = 0;
+  size_t _num_taken = 0;
+};
+
+}  // namespace http
@@ -0,0 +1,163 @@
+#include "response_serializer.h"
+
+#include <algorithm>
+#include <charconv>
+#include <vector>
+
+namespace http {
+namespace {
+
+using namespace std::string_view_literals;
+
+struct StatusLine {
+  int status;
+  std::string_view line;
+};
+
+constexpr StatusLine kStatusLines[] = {
+    {200, "HTTP/1.1 200 OK\r\n"},
+    {201, "HTTP/1.1 201 Created\r\n"},
+    {202, "HTTP/1.1 202 Accepted\r\n"},
+    {204, "HTTP/1.1 204 No Content\r\n"},
+    {206, "HTTP/1.1 206 Partial Content\r\n"},
+    {301, "HTTP/1.1 301 Moved Permanently\r\n"},
+    {302, "HTTP/1.1 302 Found\r\n"},
+    {303, "HTTP/1.1 303 See Other\r\n"},
+    {304, "HTTP/1.1 304 Not Modified\r\n"},
+    {307, "HTTP/1.1 307 Temporary Redirect\r\n"},
+    {308, "HTTP/1.1 308 Permanent Redirect\r\n"},
+    {400, "HTTP/1.1 400 Bad Request\r\n"},
+    {401, "HTTP/1.1 401 Unauthorized\r\n"},
+    {403, "HTTP/1.1 403 Forbidden\r\n"},
+    {404, "HTTP/1.1 404 Not Found\r\n"},
+    {405, "HTTP/1.1 405 Method Not Allowed\r\n"},
+    {408, "HTTP/1.1 408 Request Timeout\r\n"},
+    {409, "HTTP/1.1 409 Conflict\r\n"},
+    {410, "HTTP/1.1 410 Gone\r\n"},
+    {411, "HTTP/1.1 411 Length Required\r\n"},
+    {413, "HTTP/1.1 413 Content Too Large\r\n"},
+    {414, "HTTP/1.1 414 URI Too Long\r\n"},
+    {415, "HTTP/1.1 415 Unsupported Media Type\r\n"},
+    {429, "HTTP/1.1 429 Too Many Requests\r\n"},
+    {431, "HTTP/1.1 431 Request Header Fields Too Large\r\n"},
+    {500, "HTTP/1.1 500 Internal Server Error\r\n"},
+    {501, "HTTP/1.1 501 Not Implemented\r\n"},
+    {502, "HTTP/1.1 502 Bad Gateway\r\n"},
+    {503, "HTTP/1.1 503 Service Unavailable\r\n"},
+    {504, "HTTP/1.1 504 Gateway Timeout\r\n"},
+};
+constexpr auto kStatusLinePrefix = "HTTP/1.1 200 "sv.size();
+
+constexpr auto kKeepAliveHeader = "connection: keep-alive\r\n"sv;
+constexpr auto kCloseHeader = "connection: close\r\n"sv;
+constexpr auto kChunkedHeader = "transfer-encoding: chunked\r\n"sv;
+// todo: better default?
+constexpr auto kDefaultContentTypeHeader = "content-type: text/html\r\n"sv;
+
+const StatusLine *findStatusLine(int status) {
+  auto it = std::find_if(std::begin(kStatusLines), std::end(kStatusLines),
+                         [status](auto &line) { return line.status == status; });
+  return it != std::end(kStatusLines) ? &*it : nullptr;
+}
+
+void appendNumber(int64_t number, std::string &out) {
+  char digits[20];
+  auto end = std::to_chars(std::begin(digits), std::end(digits), number).ptr;
+  out.append(digits, end);
+}
+
+// Informational responses, 204 and 304 never have a body, nor a length for one.
+bool mayHaveBody(int status) { return status >= 200 && status != 204 && status != 304; }
+
+}  // namespace
+
+ResponseFraming framingFor(const Response &res, bool keep_alive, bool http_1_1, bool head_only) {
+  auto framing = ResponseFraming{.keep_alive = keep_alive, .head_only = head_only};
+  framing.length_unknown = !head_only && res.headers.contains("transfer-encoding") &&
+                           !res.headers.contains("content-length");
+  if (framing.length_unknown) {
+    // Older clients read until the connection closes instead.
+    framing.chunked = http_1_1;
+    framing.keep_alive = keep_alive && http_1_1;
+  }
+  return framing;
+}
+
+std::string_view reasonPhrase(int status) {
+  auto *status_line = findStatusLine(status);
+  return status_line ? status_line->line.substr(kStatusLinePrefix,
+                                                status_line->line.size() - kStatusLinePrefix - 2)
+                     : std::string_view();
+}
+
+void serializeHead(const Response &res, const ResponseFraming &framing, std::string &out) {
+  if (auto *status_line = findStatusLine(res.status)) {
+    out += status_line->line;
+  } else {
+    out += "HTTP/1.1 ";
+    appendNumber(res.status, out);
+    out += " \r\n";
+  }
+
+  auto has_content_type = false;
+  auto has_content_length = false;
+  for (auto &[name, value] : res.headers) {
+    // Only the framing of this connection applies, not that of where the response came from.
+    if (name == "connection" || name == "transfer-encoding") {
+      continue;
+    }
+    has_content_type = has_content_type || name == "content-type";
+    has_content_length = has_content_length || name == "content-length";
+    out += name;
+    out += ": ";
+    out += value;
+    out += "\r\n";
+  }
+
+  if (mayHaveBody(res.status)) {
+    if (!has_content_type) {
+      out += kDefaultContentTypeHeader;
+    }
+    if (framing.chunked) {
+      out += kChunkedHeader;
+    } else if (!framing.length_unknown && !has_content_length) {
+      out += "content-length: ";
+      appendNumber(res.body.size(), out);
+      out += "\r\n";
+    }
+  }
+  out += framing.keep_alive ? kKeepAliveHeader : kCloseHeader;
+  out += "\r\n";
+}
+
+CachedResponse::CachedResponse(Response res) : _response{std::move(res)} {
+  for (auto keep_alive : {true, false}) {
+    auto &bytes = keep_alive ? _keep_alive_bytes : _close_bytes;
+    serializeHead(_response, {.keep_alive = keep_alive}, bytes);
+    (keep_alive ? _keep_alive_head_size : _close_head_size) = bytes.size();
+    if (mayHaveBody(_response.status)) {
+      bytes += _response.body;
+    }
+  }
+}
+
+std::string_view CachedResponse::bytes(bool keep_alive, bool head_only) const {
+  auto bytes = std::string_view(keep_alive ? _keep_alive_bytes : _close_bytes);
+  return head_only ? bytes.substr(0, keep_alive ? _keep_alive_head_size : _close_head_size)
+                   : bytes;
+}
+
+const CachedResponse *CachedResponse::withStatus(int status) {
+  static const auto kResponses = [] {
+    auto responses = std::vector<CachedResponse>();
+    for (auto status : {204, 400, 404, 413, 431, 500, 502, 503, 504}) {
+      responses.emplace_back(Response(status));
+    }
+    return responses;
+  }();
+  auto it = std::find_if(kResponses.begin(), kResponses.end(),
+                         [status](auto &res) { return res.response().status == status; });
+  return it != kResponses.end() ? &*it : nullptr;
+}
+
+}  // namespace http
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <http/http.h>
+
+#include <string>
+#include <string_view>
+
+namespace http {
+
+// How a response goes out on a connection. Decided by the connection, in place of any framing
+// headers the response came with.
+struct ResponseFraming {
+  bool keep_alive = false;
+  // The body goes on until the end of the response is signalled, rather than for a known length.
+  bool length_unknown = false;
+  // A body of unknown length is sent in chunks, rather than until the connection closes.
+  bool chunked = false;
+  // Only the head is sent, as for a HEAD request.
+  bool head_only = false;
+};
+
+// Responses of unknown length are only kept open for clients that take chunks.
+ResponseFraming framingFor(const Response &, bool keep_alive, bool http_1_1, bool head_only);
+
+// "OK" for 200 and so on, or empty for a status without a known phrase.
+std::string_view reasonPhrase(int status);
+
+// Appends the status line and headers of |res| to |out|, with framing headers for |framing|, and
+// a content-type if it has none.
+void serializeHead(const Response &res, const ResponseFraming &framing, std::string &out);
+
+// A response serialized once, up front, to be written as is every time it's sent. For responses
+// that are sent over and over, such as those of states that haven't changed since.
+class CachedResponse final {
+ public:
+  explicit CachedResponse(Response);
+
+  const Response &response() const { return _response; }
+  // The whole response, or its head alone.
+  std::string_view bytes(bool keep_alive, bool head_only) const;
+
+  // Common responses without a body or headers, or null for other statuses.
+  static const CachedResponse *withStatus(int status);
+
+ private:
+  Response _response;
+  std::string _keep_alive_bytes;
+  std::string _close_bytes;
+  size_t _keep_alive_head_size = 0;
+  size_t _close_head_size = 0;
+};
+
+}  // namespace http
@@ -1,388 +1,785 @@
 #include "server.h"
 
 #include <algorithm>
+#include <array>
 #include <asio.hpp>
+#include <atomic>
+#include <charconv>
+#include <deque>
+#include <filesystem>
 #include <iostream>
 #include <numeric>
+#include <optional>
 #include <set>
-#include <span>
 #include <string_view>
+#include <vector>
 
 #include "async/scheduler.h"
-#include "http/util.h"
+#include "request_parser.h"
 
 namespace http {
 namespace {
 
-Method methodFromString(std::string_view str) {
-  auto cmp = [](auto lhs, auto rhs) { return std::toupper(lhs) == rhs; };
-  if (std::equal(str.begin(), str.end(), "GET", cmp)) {
-    return Method::GET;
-  } else if (std::equal(str.begin(), str.end(), "POST", cmp)) {
-    return Method::POST;
-  } else if (std::equal(str.begin(), str.end(), "PUT", cmp)) {
-    return Method::PUT;
-  } else if (std::equal(str.begin(), str.end(), "DELETE", cmp)) {
-    return Method::DELETE;
-  } else if (std::equal(str.begin(), str.end(), "HEAD", cmp)) {
-    return Method::HEAD;
-  } else if (std::equal(str.begin(), str.end(), "OPTIONS", cmp)) {
-    return Method::OPTIONS;
-  }
-  return Method::UNKNOWN;
-}
+// Room for the status line and headers of most responses, so that they are serialized without
+// growing the buffer.
+constexpr size_t kHeadReserve = 256;
+// Bodies up to this size are copied in after the head, to go out in a single buffer.
+constexpr size_t kMaxCopiedBodySize = 4 * 1024;
+
+// ServerStats as they are counted, on all I/O threads.
+struct Counters {
+  std::atomic<int> open_connections = 0;
+  std::atomic<uint64_t> connections_rejected = 0;
+  std::atomic<uint64_t> bad_requests = 0;
+  std::atomic<uint64_t> heads_too_large = 0;
+  std::atomic<uint64_t> bodies_too_large = 0;
+  std::atomic<uint64_t> request_timeouts = 0;
+  std::atomic<uint64_t> read_timeouts = 0;
+  std::atomic<uint64_t> write_timeouts = 0;
+};
+
+struct ConnectionBase {
+  virtual ~ConnectionBase() = default;
+  // Called on the main thread once the I/O thread has stopped, as the server goes away. Lets go of
+  // the handler's work, and with it of whatever the handler keeps the connection alive with.
+  virtual void abandon() = 0;
+};
+
+// Reads requests from and writes responses to a connection, over TCP or a Unix domain socket.
+template <typename Protocol>
+struct Connection : public ConnectionBase,
+                    public std::enable_shared_from_this<Connection<Protocol>> {
+  using Socket = typename Protocol::socket;
+  using OnDone = std::function<void(std::shared_ptr<Connection>)>;
+  using std::enable_shared_from_this<Connection>::shared_from_this;
+
+  Connection(async::Scheduler &main_scheduler,
+             RequestHandler &handler,
+             const ServerConfig &config,
+             Counters &counters,
+             std::shared_ptr<asio::io_context> ctx,
+             Socket &&peer,
+             OnDone on_done)
+      : _main_scheduler{main_scheduler},
+        _handler{handler},
+        _config{config},
+        _fast_handler{config.fast_handler},
+        _counters{counters},
+        _ctx_lifetime{std::move(ctx)},
+        _ctx{*_ctx_lifetime},
+        _peer{std::move(peer)},
+        _on_done{std::move(on_done)} {}
+
+  void start() {
+    // On a connection that is kept open, Nagle would hold back writes until the client has
+    // acknowledged the previous response, which it delays in turn.
+    if constexpr (std::is_same_v<Protocol, asio::ip::tcp>) {
+      asio::error_code ignored_err;
+      (void)_peer.set_option(asio::ip::tcp::no_delay(true), ignored_err);
+    }
+    armRequestTimer();
+    parseSome();
+  }
+
+  void abandon() final {
+    _abandoned = true;
+    asio::error_code ignored_err;
+    (void)_peer.close(ignored_err);
+    _timer.cancel();
+    _write_timer.cancel();
+    _handler_work.reset();
+    _body_work.reset();
+    _main_work.reset();
+    _on_body = {};
+  }
 
-class RequestParser {
  private:
-  struct PendingMethod {
-    PendingMethod() { buffer.reserve(7); }
+  struct ParsedRequest {
     Request req;
-    std::string buffer;
+    bool keep_alive;
+    // Whether the client takes a chunked response.
+    bool http_1_1;
   };
-  struct PendingUrl {
-    Request req;
-  };
-  struct PendingHeader {
-    Request req;
-    std::string buffer;
-  };
-  struct PendingBody {
-    Request req;
+
+  // Releases a piece of a streamed request body.
+  struct BodyPieceHandle {
+    BodyPieceHandle(std::function<void()> release) : release{std::move(release)} {}
+    ~BodyPieceHandle() { release(); }
+    std::function<void()> release;
   };
 
- public:
-  struct Input {
-    std::string &buffer;
-    size_t hint = 0;
+  // The framing of a chunk of a response body.
+  struct ChunkHandle {
+    std::string size_line;
+    http::Lifetime data;
   };
-  using ParseResult = std::variant<std::error_code, Request, Input>;
 
-  ParseResult operator()(PendingMethod &p) {
-    auto end = p.buffer.find(' ');
-    if (end == std::string::npos) {
-      return Input{.buffer = p.buffer};
-    }
-    p.req.method = methodFromString(std::string_view(p.buffer).substr(0, end));
-    p.req.url = std::string(std::move(p.buffer), end + 1);
-    _state = PendingUrl{.req = std::move(p.req)};
-    return {};
+  ParsedRequest parsedRequest() {
+    return {.req = _request_parser.request(),
+            .keep_alive = _request_parser.keepAlive(),
+            .http_1_1 = _request_parser.isHttp11()};
   }
 
-  ParseResult operator()(PendingUrl &p) {
-    auto end = p.req.url.find('\n');
-    if (end == std::string::npos) {
-      return Input{.buffer = p.req.url};
+  void parseSome(size_t num_read = 0) {
+    // The parser reuses the space of a streamed piece of body.
+    if (_body_piece_held) {
+      return;
     }
-    auto buffer = p.req.url.substr(end + 1);
-    auto path_end = p.req.url.find(' ');
-    p.req.url.resize(path_end == std::string::npos ? 0 : path_end);
-    _state = PendingHeader{.req = std::move(p.req), .buffer = std::move(buffer)};
-    return {};
-  }
-
-  ParseResult operator()(PendingHeader &p) {
     for (;;) {
-      auto end = p.buffer.find("\r\n");
-      if (end == 0) {
-        p.req.body = std::string(std::move(p.buffer), 2);
-        _state = PendingBody{.req = std::move(p.req)};
-        return {};
+      auto status = _request_parser.parse(std::exchange(num_read, 0));
+      if (status == RequestParser::Status::kError) {
+        return rejectRequest(400);
       }
-      if (end == std::string::npos) {
-        break;
+      if (status == RequestParser::Status::kHeadTooLarge) {
+        return rejectRequest(431);
       }
-      auto line = std::string_view(p.buffer.data(), end);
-      auto key = std::string(line.substr(0, line.find(":")));
-      auto value = std::string(trim(line.substr(key.size() + 1)));
-      std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-      p.req.headers[std::move(key)] = std::move(value);
-      p.buffer.erase(0, end + 2);
-    }
-    return Input{.buffer = p.buffer};
-  }
-
-  ParseResult operator()(PendingBody &p) {
-    auto content_length = 0u;
-    if (auto it = p.req.headers.find("content-length"); it != p.req.headers.end()) {
-      content_length = static_cast<size_t>(std::stoi(it->second));
-      if (p.req.body.size() < content_length) {
-        return Input{.buffer = p.req.body, .hint = content_length - p.req.body.size()};
+      auto streaming = std::holds_alternative<StreamingHandler>(_handler);
+      // Before any of the body is read.
+      if (!streaming && _request_parser.headComplete() &&
+          _request_parser.contentLength() > _config.max_body_size) {
+        return rejectRequest(413);
       }
+      if (streaming && _request_parser.headComplete()) {
+        if (!streamBody(status)) {
+          return;
+        }
+        continue;
+      }
+      if (status == RequestParser::Status::kIncomplete) {
+        return readSome();
+      }
+      auto parsed = parsedRequest();
+      _request_parser.next();
+      // Pipelined requests are answered in order, so hold on to the next one and stop reading
+      // until the current one has been answered.
+      if (_in_flight) {
+        _next_request = std::move(parsed);
+        return;
+      }
+      handleRequest(std::move(parsed));
     }
-    p.req.body.resize(content_length);
-    return std::move(p.req);
   }
 
-  ParseResult parseSome() { return std::visit(*this, _state); }
-
- private:
-  using State = std::variant<PendingMethod, PendingUrl, PendingHeader, PendingBody>;
-  State _state;
-};
-
-struct Connection : public std::enable_shared_from_this<Connection> {
-  using tcp = asio::ip::tcp;
-  using OnDone = std::function<void(std::shared_ptr<Connection>)>;
-
-  Connection(async::Scheduler &main_scheduler,
-             RequestHandler &handler,
-             asio::io_context &ctx,
-             tcp::socket &&peer,
-             OnDone on_done)
-      : _main_scheduler{main_scheduler},
-        _handler{handler},
-        _ctx{ctx},
-        _peer{std::move(peer)},
-        _on_done{std::move(on_done)} {}
-
-  void start() { parseSome(); }
-
- private:
-  void parseSome(std::error_code err = {}) {
-    while (!err) {
-      auto result = _request_parser.parseSome();
-
-      if (auto *request = std::get_if<Request>(&result)) {
-        return handleRequest(std::move(*request));
-      } else if (auto *input = std::get_if<RequestParser::Input>(&result)) {
-        return readSome(*input);
+  // Passes the body of the request to the streaming handler as it's read, and returns whether to
+  // parse on.
+  bool streamBody(RequestParser::Status status) {
+    if (!_streaming_body) {
+      // The next request waits for the current one to be answered, without reading its body.
+      if (_in_flight) {
+        return false;
       }
-      err = std::get<std::error_code>(result);
+      _request_parser.streamBody();
+      _streaming_body = true;
+      handleRequest(parsedRequest());
+    }
+    auto piece = _request_parser.takeBody();
+    if (!piece.empty()) {
+      // Reading on would overwrite the piece, so that waits until the handler lets go of it.
+      sendBodyPiece(piece);
+      return false;
     }
-    return handleError(err);
+    if (status == RequestParser::Status::kIncomplete) {
+      readSome();
+      return false;
+    }
+    sendBodyPiece({});
+    _streaming_body = false;
+    _request_parser.next();
+    return true;
   }
 
-  void readSome(RequestParser::Input &input) {
-    auto &[buffer, hint] = input;
-    auto num_buffered = buffer.size();
+  void readSome() {
+    // Reading on while a request is handled also notices the client going away.
+    auto buffer = _request_parser.readBuffer();
+    _reading = true;
+    if (_streaming_body) {
+      armReadTimer();
+    }
+    _peer.async_read_some(asio::buffer(buffer.data(), buffer.size()),
+                          [this, self = shared_from_this()](auto err, auto num_read) {
+                            _reading = false;
+                            if (_streaming_body) {
+                              _timer.cancel();
+                            }
+                            return err ? handleError(err) : parseSome(num_read);
+                          });
+  }
 
-    buffer.resize(num_buffered + (hint ? hint : std::clamp<size_t>(2 * num_buffered, 128, 1024)));
+  // Answers a request that can't be handled with |status|, and closes the connection.
+  void rejectRequest(int status) {
+    ++(status == 431   ? _counters.heads_too_large
+       : status == 413 ? _counters.bodies_too_large
+                       : _counters.bad_requests);
+    // The request before it is answered first.
+    if (_in_flight) {
+      _rejection = status;
+      return;
+    }
+    sendRejection(status);
+  }
 
-    auto slice = std::span{buffer}.subspan(num_buffered);
-    _peer.async_read_some(
-        asio::buffer(slice.data(), slice.size_bytes()),
-        [this, self = shared_from_this(), buffer, num_buffered](auto err, auto num_read) mutable {
-          buffer.resize(num_buffered + num_read);
-          return parseSome(err);
-        });
+  void sendRejection(int status) {
+    _timer.cancel();
+    _in_flight = true;
+    _keep_alive = _head_only = false;
+    writeResponse(Response(status));
+    writeData({}, {});
   }
 
-  void handleRequest(Request req) {
+  void handleRequest(ParsedRequest parsed) {
+    auto &req = parsed.req;
 #if 0
     std::cout << int(req.method) << " " << req.url << " "
               << (req.headers.contains("action") ? req.headers["action"] : "") << "\n"
               << req.body << std::endl;
 #endif
+    _timer.cancel();
+    _in_flight = true;
+    _keep_alive = parsed.keep_alive;
+    _http_1_1 = parsed.http_1_1;
+    _head_only = req.method == Method::HEAD;
+
+    if (auto cached = _fast_handler ? _fast_handler(req) : nullptr) {
+      writeCached(*cached, std::const_pointer_cast<CachedResponse>(cached));
+      return writeData({}, {});
+    }
+    _handled_on_main = true;
+    _handler_work = _main_scheduler.schedule([this, self = shared_from_this(),
+                                              req = std::move(req),
+                                              response = _num_responses]() mutable {
+      if (auto *handler = std::get_if<SyncHandler>(&_handler)) {
+        sendResponse((*handler)(std::move(req)));
+        sendEnd(response);
+
+      } else if (auto *handler = std::get_if<AsyncHandler>(&_handler)) {
+        _main_work = (*handler)(std::move(req), responseOptions(response));
+
+      } else if (auto *handler = std::get_if<StreamingHandler>(&_handler)) {
+        _main_work = (*handler)(std::move(req), responseOptions(response), _on_body);
+      }
+    });
+  }
 
-    _handler_work =
-        _main_scheduler.schedule([this, self = shared_from_this(), req = std::move(req)]() mutable {
-          if (auto *handler = std::get_if<SyncHandler>(&_handler)) {
-            sendResponse((*handler)(std::move(req)));
-
-          } else if (auto *handler = std::get_if<AsyncHandler>(&_handler)) {
-            _main_work = (*handler)(
-                std::move(req),
-                {.post_to = _main_scheduler,
-                 .on_response = [this, self](auto res) mutable { sendResponse(std::move(res)); },
-                 .on_bytes = [this, self](
-                                 auto, auto data,
-                                 auto lifetime) mutable { sendData(data, std::move(lifetime)); }});
+  // Main thread
+  RequestOptions responseOptions(uint64_t response) {
+    auto self = shared_from_this();
+    return {.post_to = _main_scheduler,
+            .on_response = [this, self](auto res) { sendResponse(std::move(res)); },
+            .on_bytes = [this, self](auto, auto data,
+                                     auto lifetime) { sendData(data, std::move(lifetime)); },
+            .on_done = [this, self, response] { sendEnd(response); },
+            // Data goes straight from the http thread to asio, and only the response head and
+            // completion pass through main.
+            .bytes_on_http_thread = true};
+  }
+
+  void sendBodyPiece(std::string_view piece) {
+    auto lifetime = http::Lifetime();
+    if (!piece.empty()) {
+      _body_piece_held = true;
+      lifetime = std::make_shared<BodyPieceHandle>([this, self = shared_from_this()] {
+        if (_abandoned) {
+          return;
+        }
+        asio::post(_ctx, [this, self] {
+          _body_piece_held = false;
+          if (!_reading) {
+            parseSome();
+          }
+        });
+      });
+    }
+    _body_work = _main_scheduler.schedule(
+        [this, self = shared_from_this(), piece, lifetime = std::move(lifetime)]() mutable {
+          if (auto on_body = piece.empty() ? std::exchange(_on_body, {}) : _on_body) {
+            on_body(piece, std::move(lifetime));
           }
         });
-
-    pollSocket();
   }
 
   void handleError(std::error_code err) {
-    std::cerr << "Failed to read request: " << err << std::endl;
-    if (err != asio::error::operation_aborted) {
-      _on_done(shared_from_this());
-      _peer.close();
+    if (err == asio::error::operation_aborted || !_peer.is_open()) {
+      return;
+    }
+    if (err != asio::error::eof) {
+      std::cerr << "Failed to read request: " << err << std::endl;
+    }
+    if (_handled_on_main) {
+      _handler_work = _main_scheduler.schedule([this, self = shared_from_this()] {
+        _main_work.reset();
+        _on_body = {};
+      });
     }
+    close();
   }
 
-  void pollSocket() {
-    _peer.async_read_some(
-        asio::buffer(_poll_buffer), [this, self = shared_from_this()](auto err, auto) {
-          if (!_peer.is_open()) {
-            return;
-          }
-          if (!err) {
-            pollSocket();
-            return;
-          }
-          if (err == asio::error::eof) {
-            _handler_work = _main_scheduler.schedule([this, self] { _main_work.reset(); });
-            asio::error_code ignored_err;
-            (void)_peer.shutdown(tcp::socket::shutdown_both, ignored_err);
-          }
-          if (err != asio::error::operation_aborted) {
-            _on_done(self);
-            (void)_peer.close(err);
-          }
-        });
-  }
+  // Asio thread, once the whole response has been written.
+  void onResponseSent() {
+    ++_num_responses;
+    if (!_keep_alive) {
+      return close();
+    }
+    _in_flight = false;
+    _head_sent = false;
+    _bytes_sent = 0;
+    _content_length = 0;
+    _length_unknown = _chunked = _body_ended = false;
+    if (std::exchange(_handled_on_main, false)) {
+      _handler_work = _main_scheduler.schedule([this, self = shared_from_this()] {
+        _main_work.reset();
+      });
+    }
 
-  void sendResponse(http::Response res) {
-    if (res.headers["content-length"].empty()) {
-      res.headers["content-length"] = std::to_string(_content_length = res.body.size());
+    if (auto status = std::exchange(_rejection, 0)) {
+      return sendRejection(status);
+    }
+    if (auto next = std::exchange(_next_request, std::nullopt)) {
+      handleRequest(std::move(*next));
     } else {
-      _content_length = std::stoll(res.headers["content-length"]);
+      armRequestTimer();
+    }
+    if (!_reading) {
+      parseSome();
     }
+  }
 
-    if (res.headers["content-type"].empty()) {
-      // todo: better default?
-      res.headers["content-type"] = "text/html";
+  // Closes the connection unless a request has arrived by then. Only counts as a timeout if the
+  // client has started sending one.
+  void armRequestTimer() {
+    _timer.expires_after(_config.request_timeout);
+    _timer.async_wait([this, self = shared_from_this()](auto err) {
+      if (err || _in_flight) {
+        return;
+      }
+      if (_request_parser.hasInput()) {
+        ++_counters.request_timeouts;
+      }
+      close();
+    });
+  }
+
+  // For the body of a request that is being streamed to the handler.
+  void armReadTimer() {
+    _timer.expires_after(_config.io_timeout);
+    _timer.async_wait([this, self = shared_from_this()](auto err) {
+      if (!err && _reading && _streaming_body) {
+        ++_counters.read_timeouts;
+        close();
+      }
+    });
+  }
+
+  void close() {
+    if (!_peer.is_open()) {
+      return;
     }
+    _timer.cancel();
+    _write_timer.cancel();
+    asio::error_code ignored_err;
+    (void)_peer.shutdown(asio::socket_base::shutdown_both, ignored_err);
+    _on_done(shared_from_this());
+    (void)_peer.close(ignored_err);
+  }
 
+  // Handlers may answer after the server is gone, when nothing would run what is posted.
+  void sendResponse(http::Response res) {
+    if (_abandoned) {
+      return;
+    }
     asio::post(_ctx, [this, self = shared_from_this(), res = std::move(res)]() mutable {
       writeResponse(std::move(res));
     });
   }
 
   void sendData(std::string_view data, http::Lifetime lifetime) {
+    if (data.empty() || _abandoned) {
+      return;
+    }
     asio::post(_ctx, [this, self = shared_from_this(), data, lifetime]() mutable {
       writeData(data, std::move(lifetime));
     });
   }
 
+  // Ends a body of unknown length, unless that response is already over.
+  void sendEnd(uint64_t response) {
+    if (_abandoned) {
+      return;
+    }
+    asio::post(_ctx, [this, self = shared_from_this(), response] {
+      if (response == _num_responses) {
+        writeData({}, {});
+      }
+    });
+  }
+
   void writeResponse(http::Response res) {
+    if (res.headers.empty() && res.body.empty()) {
+      if (auto *cached = CachedResponse::withStatus(res.status)) {
+        return writeCached(*cached, {});
+      }
+    }
+    auto framing = framingFor(res, _keep_alive, _http_1_1, _head_only);
+    _keep_alive = framing.keep_alive;
+    _length_unknown = framing.length_unknown;
+    _chunked = framing.chunked;
+    // Otherwise the response is over once this much of the body has been sent.
+    _content_length = _head_only || _length_unknown ? 0 : contentLengthOf(res);
+
     struct Handle {
       http::Response res;
-      std::string status;
+      std::string head;
     };
-    auto handle = std::make_shared<Handle>();
-    handle->res = std::move(res);
-    handle->status = std::to_string(handle->res.status);
+    auto handle = std::make_shared<Handle>(Handle{.res = std::move(res), .head = {}});
+    auto &head = handle->head;
+    auto &body = handle->res.body;
+    auto with_body = !_head_only && !body.empty();
+    auto copy_body = with_body && body.size() <= kMaxCopiedBodySize;
+    head.reserve(kHeadReserve + (copy_body ? body.size() : 0));
+    serializeHead(handle->res, framing, head);
+    if (with_body && _chunked) {
+      head += chunkSizeLine(body.size());
+    }
+    _head_sent = true;
 
     using namespace std::string_view_literals;
-    auto buffers = std::vector<asio::const_buffer>{
-        asio::buffer("HTTP/1.0 "sv),
-        asio::buffer(handle->status),
-        handle->res.status == 200 ? asio::buffer(" OK"sv) : asio::buffer(" No Content"sv),
-        asio::buffer("\r\n"sv),
-    };
-    buffers.reserve(buffers.size() + handle->res.headers.size() * 4 + 2);
-
-    for (auto &[key, value] : handle->res.headers) {
-      buffers.insert(buffers.end(), {asio::buffer(key), asio::buffer(": "sv), asio::buffer(value),
-                                     asio::buffer("\r\n"sv)});
+    if (!with_body) {
+      return sendBuffers(asio::buffer(head), 0, std::move(handle));
+    }
+    if (copy_body) {
+      // Small responses go out in one piece.
+      head += body;
+      if (_chunked) {
+        head += "\r\n"sv;
+      }
+      return sendBuffers(asio::buffer(head), body.size(), std::move(handle));
     }
-    buffers.push_back(asio::buffer("\r\n"sv));
-    buffers.push_back(asio::buffer(handle->res.body));
+    auto buffers = std::array<asio::const_buffer, 3>{
+        asio::buffer(head), asio::buffer(body), asio::buffer(_chunked ? "\r\n"sv : ""sv)};
+    sendBuffers(buffers, body.size(), std::move(handle));
+  }
 
-    auto bytes = handle->res.body.size();
+  // Writes a response that was serialized up front, keeping it alive with |lifetime| meanwhile.
+  void writeCached(const CachedResponse &cached, http::Lifetime lifetime) {
+    _length_unknown = _chunked = false;
+    _content_length = _head_only ? 0 : cached.response().body.size();
+    _head_sent = true;
+    sendBuffers(asio::buffer(cached.bytes(_keep_alive, _head_only)), _content_length,
+                std::move(lifetime));
+  }
 
-    sendBuffers(std::move(buffers), bytes, std::move(handle));
+  static int64_t contentLengthOf(const http::Response &res) {
+    auto it = res.headers.find("content-length");
+    if (it == res.headers.end()) {
+      return res.body.size();
+    }
+    int64_t length = 0;
+    auto &value = it->second;
+    std::from_chars(value.data(), value.data() + value.size(), length);
+    return length;
   }
 
+  static std::string chunkSizeLine(size_t size) {
+    char hex[16];
+    auto end = std::to_chars(std::begin(hex), std::end(hex), size, 16).ptr;
+    return std::string(hex, end) + "\r\n";
+  }
+
+  // An empty buffer ends a body of unknown length.
   void writeData(std::string_view buffer, http::Lifetime &&lifetime) {
-    if (_out_buffer) {
-      _pending_send = [this, buffer, lifetime = std::move(lifetime)]() mutable {
-        sendBuffers(asio::buffer(buffer), buffer.size(), std::move(lifetime));
-      };
-    } else {
-      sendBuffers(asio::buffer(buffer), buffer.size(), std::move(lifetime));
+    _pending_sends.emplace_back(buffer, std::move(lifetime));
+    // Streamed data can arrive before the response head, which is posted from the main thread.
+    if (!_writing && _head_sent) {
+      sendPending();
+    }
+  }
+
+  void sendPending() {
+    using namespace std::string_view_literals;
+    while (!_pending_sends.empty()) {
+      auto [buffer, lifetime] = std::move(_pending_sends.front());
+      _pending_sends.pop_front();
+      if (buffer.empty()) {
+        _body_ended = _length_unknown;
+        if (_chunked) {
+          return sendBuffers(asio::buffer("0\r\n\r\n"sv), 0, {});
+        }
+        continue;
+      }
+      if (_chunked) {
+        auto chunk = std::make_shared<ChunkHandle>(
+            ChunkHandle{.size_line = chunkSizeLine(buffer.size()), .data = std::move(lifetime)});
+        auto buffers = std::array<asio::const_buffer, 3>{
+            asio::buffer(chunk->size_line), asio::buffer(buffer), asio::buffer("\r\n"sv)};
+        return sendBuffers(buffers, buffer.size(), std::move(chunk));
+      }
+      return sendBuffers(asio::buffer(buffer), buffer.size(), std::move(lifetime));
+    }
+    if (_length_unknown ? _body_ended : _bytes_sent >= _content_length) {
+      onResponseSent();
     }
   }
 
   template <typename Buffers>
   void sendBuffers(Buffers &&buffers, int64_t num_bytes, http::Lifetime &&lifetime) {
-    assert(!_out_buffer);
+    assert(!_writing);
+    _writing = true;
     _out_buffer = std::move(lifetime);
-    _peer.async_send(buffers, [this, self = shared_from_this(), num_bytes](auto err, auto) {
+    // A client that doesn't read what it's sent would otherwise hold on to it forever.
+    _write_timer.expires_after(_config.io_timeout);
+    _write_timer.async_wait([this, self = shared_from_this()](auto err) {
+      if (!err && _writing) {
+        ++_counters.write_timeouts;
+        close();
+      }
+    });
+    asio::async_write(_peer, buffers, [this, self = shared_from_this(), num_bytes](auto err, auto) {
+      _writing = false;
+      _write_timer.cancel();
       _out_buffer.reset();
       _bytes_sent += num_bytes;
 
-      if (auto pending_send = std::exchange(_pending_send, {})) {
-        return pending_send();
-      } else if (_bytes_sent < _content_length) {
-        return;
-      }
-      if (!err) {
-        asio::error_code ignored_err;
-        _peer.shutdown(tcp::socket::shutdown_both, ignored_err);
-      }
-      if (err != asio::error::operation_aborted) {
-        _on_done(self);
-        _peer.close(err);
+      if (err) {
+        _pending_sends.clear();
+        return err == asio::error::operation_aborted ? void() : close();
       }
+      sendPending();
     });
   }
 
   async::Scheduler &_main_scheduler;
   RequestHandler &_handler;
+  const ServerConfig &_config;
+  const FastHandler &_fast_handler;
+  Counters &_counters;
+  // Outlives the socket and timers, also when handlers hold on to the connection past the server.
+  std::shared_ptr<asio::io_context> _ctx_lifetime;
   asio::io_context &_ctx;
-  tcp::socket _peer;
+  Socket _peer;
   OnDone _on_done;
   RequestParser _request_parser;
-  std::array<uint8_t, 1> _poll_buffer;
+  bool _reading = false;
+  // A request is being handled, up until its response has been sent.
+  bool _in_flight = false;
+  std::optional<ParsedRequest> _next_request;
+  // The status to answer the next request with, if it couldn't be parsed.
+  int _rejection = 0;
+  bool _keep_alive = false;
+  bool _http_1_1 = false;
+  bool _head_only = false;
+  // Whether the request went to the main thread, which then has to let go of it.
+  bool _handled_on_main = false;
+  // Of a request to a streaming handler, whether its body is being passed on, and whether the
+  // handler holds on to a piece of it.
+  bool _streaming_body = false;
+  bool _body_piece_held = false;
+  OnRequestBody _on_body;  // main thread
+  // Until the next request has to be in, or until more of a streamed body has to be read.
+  asio::steady_timer _timer{_ctx};
+  asio::steady_timer _write_timer{_ctx};
+  bool _writing = false;
   http::Lifetime _out_buffer;
-  std::function<void()> _pending_send;
+  // Chunks that arrive while another is being sent. Streamed responses hand over several at once.
+  std::deque<std::pair<std::string_view, http::Lifetime>> _pending_sends;
+  bool _head_sent = false;
   int64_t _bytes_sent = 0;
   int64_t _content_length = 0;
+  // A body of unknown length goes on until an empty buffer is written, in chunks if the client
+  // takes those.
+  bool _length_unknown = false;
+  bool _chunked = false;
+  bool _body_ended = false;
+  // Counts responses, to tell which one a late end of body belongs to.
+  uint64_t _num_responses = 0;
   async::Lifetime _handler_work;  // set on asio - runs on main
+  async::Lifetime _body_work;     // set on asio - runs on main
   async::Lifetime _main_work;     // set on main - runs on main
+  std::atomic_bool _abandoned = false;
+};
+
+// An io_context with a thread of its own, and the connections that it serves.
+struct Worker {
+  using tcp = asio::ip::tcp;
+  using local = asio::local::stream_protocol;
+
+  explicit Worker(int index) : thread{async::Thread::create("asio-" + std::to_string(index))} {}
+
+  // Shared with the connections, which may outlive the worker.
+  std::shared_ptr<asio::io_context> ctx = std::make_shared<asio::io_context>();
+  // Keeps run() going on workers without an acceptor, in between connections.
+  asio::executor_work_guard<asio::io_context::executor_type> work = asio::make_work_guard(*ctx);
+  std::optional<tcp::acceptor> acceptor;
+  std::optional<local::acceptor> local_acceptor;
+  std::unique_ptr<async::Thread> thread;
+  async::Lifetime run;
+  // Of either protocol.
+  std::set<std::shared_ptr<ConnectionBase>> connections;
 };
 
 struct ServerImpl : Server {
   using tcp = asio::ip::tcp;
+  using local = asio::local::stream_protocol;
+  using ReusePort = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
 
-  ServerImpl(async::Scheduler &main_scheduler, RequestHandler handler)
+  ServerImpl(async::Scheduler &main_scheduler, RequestHandler handler, const ServerConfig &config)
       : _main_scheduler{main_scheduler},
         _handler{std::move(handler)},
-        _thread{async::Thread::create("asio")} {
-    _acceptor.set_option(tcp::acceptor::reuse_address(true));
-    _acceptor.listen();
-    accept();
-    _asio_work = _thread->scheduler().schedule([this] { _ctx.run(); });
+        _config{config},
+        _reuse_port{config.reuse_port} {
+    for (int i = 0; i < std::max(config.io_threads, 1); ++i) {
+      _workers.push_back(std::make_unique<Worker>(i));
+    }
+    auto endpoint = tcp::endpoint(asio::ip::make_address(config.address), config.port);
+    auto num_acceptors = _reuse_port ? _workers.size() : 1;
+    for (size_t i = 0; i < num_acceptors; ++i) {
+      auto &worker = *_workers[i];
+      auto &acceptor = worker.acceptor.emplace(*worker.ctx, endpoint.protocol());
+      acceptor.set_option(tcp::acceptor::reuse_address(true));
+      if (_reuse_port) {
+        acceptor.set_option(ReusePort(true));
+      }
+      acceptor.bind(endpoint);
+      acceptor.listen();
+      // The rest listen on the port that the first one got.
+      endpoint = acceptor.local_endpoint();
+      accept(acceptor, _reuse_port ? &worker : nullptr);
+    }
+    if (!config.unix_socket.empty()) {
+      listenLocal(*_workers.front());
+    }
+    for (auto &worker : _workers) {
+      worker->run = worker->thread->scheduler().schedule([&ctx = *worker->ctx] { ctx.run(); });
+    }
   }
   ~ServerImpl() {
-    asio::error_code err;
-    if ((void)_acceptor.close(err); err) {
-      std::cerr << "Failed to close server: " << err << std::endl;
+    for (auto &worker : _workers) {
+      worker->ctx->stop();
+    }
+    // Connections are only touched on their own thread, so wait for those to finish first.
+    for (auto &worker : _workers) {
+      worker->run.reset();
+      worker->thread.reset();
+    }
+    // Handlers that are still at work hold on to their connections, which mustn't keep the handler
+    // or the I/O context alive. What was left posted lets go of the connections once it has run
+    // into the closed sockets here, on this thread.
+    for (auto &worker : _workers) {
+      asio::error_code ignored_err;
+      if (worker->acceptor) {
+        (void)worker->acceptor->close(ignored_err);
+      }
+      if (worker->local_acceptor) {
+        (void)worker->local_acceptor->close(ignored_err);
+      }
+      // Connections that were still being handed over are only made while polling.
+      worker->ctx->restart();
+      do {
+        for (auto &connection : std::exchange(worker->connections, {})) {
+          connection->abandon();
+        }
+      } while (worker->ctx->poll());
+    }
+    if (!_config.unix_socket.empty()) {
+      std::error_code ignored_err;
+      std::filesystem::remove(_config.unix_socket, ignored_err);
     }
-    _ctx.stop();
   }
 
-  int port() const final { return _acceptor.local_endpoint().port(); }
+  int port() const final { return _workers.front()->acceptor->local_endpoint().port(); }
+
+  ServerStats stats() const final {
+    return {.open_connections = _counters.open_connections,
+            .connections_rejected = _counters.connections_rejected,
+            .bad_requests = _counters.bad_requests,
+            .heads_too_large = _counters.heads_too_large,
+            .bodies_too_large = _counters.bodies_too_large,
+            .request_timeouts = _counters.request_timeouts,
+            .read_timeouts = _counters.read_timeouts,
+            .write_timeouts = _counters.write_timeouts};
+  }
 
  private:
-  void accept() {
-    _acceptor.async_accept(_ctx, [this](auto err, tcp::socket peer) {
-      if (!_acceptor.is_open() || err == asio::error::operation_aborted) {
+  void listenLocal(Worker &worker) {
+    auto &path = _config.unix_socket;
+    // Left behind by a previous run that didn't exit cleanly.
+    if (std::filesystem::is_socket(path)) {
+      std::filesystem::remove(path);
+    }
+    auto &acceptor = worker.local_acceptor.emplace(*worker.ctx);
+    auto endpoint = local::endpoint(path);
+    acceptor.open(endpoint.protocol());
+    acceptor.bind(endpoint);
+    // Before listening, so that no one connects while the permissions are still wider.
+    std::filesystem::permissions(path, std::filesystem::perms(_config.unix_socket_mode));
+    acceptor.listen();
+    accept(acceptor, nullptr);
+  }
+
+  // Accepts connections for |own_worker|, or for all workers in turn without one.
+  template <typename Acceptor>
+  void accept(Acceptor &acceptor, Worker *own_worker) {
+    using Protocol = typename Acceptor::protocol_type;
+    auto &target = own_worker ? *own_worker : *_workers[_next_worker++ % _workers.size()];
+    acceptor.async_accept(*target.ctx, [this, &acceptor, own_worker, &target](
+                                          auto err, typename Protocol::socket peer) {
+      if (!acceptor.is_open() || err == asio::error::operation_aborted) {
         return;
       }
-      if (!err) {
-        auto connection =
-            std::make_shared<Connection>(_main_scheduler, _handler, _ctx, std::move(peer),
-                                         [this](auto conn) { _connections.erase(conn); });
-        _connections.insert(connection);
-        connection->start();
+      if (!err && _counters.open_connections++ >= _config.max_connections) {
+        --_counters.open_connections;
+        rejectConnection(peer);
+      } else if (!err) {
+        asio::post(*target.ctx, [this, &target, peer = std::move(peer)]() mutable {
+          auto connection = std::make_shared<Connection<Protocol>>(
+              _main_scheduler, _handler, _config, _counters, target.ctx, std::move(peer),
+              [this, &target](auto conn) {
+                target.connections.erase(conn);
+                --_counters.open_connections;
+              });
+          target.connections.insert(connection);
+          connection->start();
+        });
       } else {
         std::cerr << "Failed to accept connection: " << err << std::endl;
       }
 
-      accept();
+      accept(acceptor, own_worker);
     });
   }
 
+  // Turns a connection away right on the accepting thread, without reading from it.
+  template <typename Socket>
+  void rejectConnection(Socket &peer) {
+    static constexpr auto kResponse = std::string_view(
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "content-length: 0\r\n"
+        "connection: close\r\n"
+        "retry-after: 1\r\n"
+        "\r\n");
+    ++_counters.connections_rejected;
+    asio::error_code ignored_err;
+    (void)peer.non_blocking(true, ignored_err);
+    (void)peer.write_some(asio::buffer(kResponse), ignored_err);
+    (void)peer.shutdown(asio::socket_base::shutdown_both, ignored_err);
+    (void)peer.close(ignored_err);
+  }
+
   async::Scheduler &_main_scheduler;
   RequestHandler _handler;
+  ServerConfig _config;
+  bool _reuse_port;
+  Counters _counters;
 
-  asio::io_context _ctx;
-  tcp::acceptor _acceptor{_ctx, tcp::endpoint(tcp::v4(), 8080)};
-
-  std::unique_ptr<async::Thread> _thread;
-  async::Lifetime _asio_work;
-
-  std::set<std::shared_ptr<Connection>> _connections;
+  std::vector<std::unique_ptr<Worker>> _workers;
+  // Used by the acceptors on the first worker, which hand connections to all of them.
+  size_t _next_worker = 0;
 };
 
 }  // namespace
 
-std::unique_ptr<Server> makeServer(async::Scheduler &main_scheduler, RequestHandler handler) {
-  return std::make_unique<ServerImpl>(main_scheduler, std::move(handler));
+std::unique_ptr<Server> makeServer(async::Scheduler &main_scheduler,
+                                   RequestHandler handler,
+                                   const ServerConfig &config) {
+  return std::make_unique<ServerImpl>(main_scheduler, std::move(handler), config);
 }
 
 }  // namespace http
@@ -2,23 +2,91 @@
 
 #include <async/scheduler.h>
 #include <http/http.h>
+#include <http/server/response_serializer.h>
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <variant>
 
 namespace http {
 
+// Connections and requests that the server turned away or gave up on, to protect itself.
+struct ServerStats {
+  int open_connections = 0;
+  // Over max_connections, answered with a 503.
+  uint64_t connections_rejected = 0;
+  // Answered with a 400, 431 and 413 respectively.
+  uint64_t bad_requests = 0;
+  uint64_t heads_too_large = 0;
+  uint64_t bodies_too_large = 0;
+  // Closed for not sending a request in time, or not reading or writing for too long.
+  uint64_t request_timeouts = 0;
+  uint64_t read_timeouts = 0;
+  uint64_t write_timeouts = 0;
+};
+
 struct Server {
   virtual ~Server() = default;
   virtual int port() const = 0;
+  virtual ServerStats stats() const = 0;
 };
 
+// A response without a content-length but with a transfer-encoding header has a body of unknown
+// length. It is sent chunked: the body of the response first, then what is passed to on_bytes,
+// until on_done is called. Sync handlers' responses end right away.
 using SyncHandler = std::function<Response(Request)>;
 using AsyncHandler = std::function<Lifetime(Request, RequestOptions)>;
 
-using RequestHandler = std::variant<SyncHandler, AsyncHandler>;
+// Gets the body of a request in pieces as it is read, on the main thread. A piece stays valid
+// until its Lifetime is released, and the next piece is only read after that. An empty piece ends
+// the body.
+using OnRequestBody = std::function<void(std::string_view, Lifetime)>;
+// Like AsyncHandler, but called once the head of a request is in, with Request::body left empty.
+// The body goes to what the handler sets |on_body| to.
+using StreamingHandler = std::function<Lifetime(Request, RequestOptions, OnRequestBody &on_body)>;
+
+using RequestHandler = std::variant<SyncHandler, AsyncHandler, StreamingHandler>;
+
+// Called on the I/O thread before the request handler, to answer requests that don't need the
+// main thread. Must be thread-safe and quick. Returns a response serialized up front, which the
+// connection holds on to while writing it, or null to pass the request on.
+using FastHandler = std::function<std::shared_ptr<const CachedResponse>(const Request &)>;
+
+struct ServerConfig {
+  std::string address = "0.0.0.0";
+  // 0 picks a free port.
+  int port = 8080;
+  // Threads that read and write the connections. Handlers still run on the scheduler that is
+  // passed to makeServer.
+  int io_threads = 1;
+  // Every I/O thread listens on a socket of its own, and the kernel spreads new connections
+  // across them. Otherwise one socket accepts them and hands them to the threads in turn.
+  bool reuse_port = false;
+  // Also listens on a Unix domain socket at this path, for processes on the same machine, with
+  // access to it controlled by the file mode. Requests on it are handled the same.
+  std::string unix_socket;
+  unsigned unix_socket_mode = 0660;
+  FastHandler fast_handler;
+
+  // Limits that keep misbehaving clients from using up memory and sockets. Headers are limited to
+  // what fits the buffer of a connection, and bodies streamed to a StreamingHandler to the pace of
+  // the handler.
+  int max_connections = 128;
+  size_t max_body_size = 1024 * 1024;
+  // A request has to arrive in full within this long of the connection opening or the previous
+  // response, which also closes connections that sit idle.
+  std::chrono::milliseconds request_timeout = std::chrono::seconds{30};
+  // Reading a streamed body, or writing a response, gives up after this long without progress.
+  std::chrono::milliseconds io_timeout = std::chrono::seconds{30};
+};
 
-std::unique_ptr<Server> makeServer(async::Scheduler &, RequestHandler);
+std::unique_ptr<Server> makeServer(async::Scheduler &,
+                                   RequestHandler,
+                                   const ServerConfig &config = {});
 
 }  // namespace http
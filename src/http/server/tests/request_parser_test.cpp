@@ -0,0 +1,249 @@
+#include "http/server/request_parser.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Feeds pipelined requests to the parser split at every byte boundary and checks that they come
+// out the same, then reports how fast it parses typical requests.
+
+namespace {
+
+constexpr int kBenchRequests = 200000;
+
+struct Parsed {
+  http::Method method;
+  std::string url;
+  http::Headers headers;
+  std::string body;
+  bool keep_alive;
+
+  bool operator==(const Parsed &) const = default;
+};
+
+// Feeds input in chunks that end at |splits|, as reads from a socket would.
+std::vector<Parsed> parseAll(http::RequestParser &parser,
+                             std::string_view input,
+                             const std::vector<size_t> &splits) {
+  auto parsed = std::vector<Parsed>();
+  size_t offset = 0;
+  auto feed = [&](size_t end) {
+    while (offset < end) {
+      auto buffer = parser.readBuffer();
+      assert(!buffer.empty());
+      auto n = std::min(buffer.size(), end - offset);
+      std::memcpy(buffer.data(), input.data() + offset, n);
+      offset += n;
+      for (auto status = parser.parse(n); status == http::RequestParser::Status::kComplete;
+           status = parser.parse(0)) {
+        auto req = parser.request();
+        parsed.push_back({.method = req.method,
+                          .url = std::move(req.url),
+                          .headers = std::move(req.headers),
+                          .body = std::move(req.body),
+                          .keep_alive = parser.keepAlive()});
+        parser.next();
+      }
+    }
+  };
+  for (auto split : splits) {
+    feed(split);
+  }
+  feed(input.size());
+  return parsed;
+}
+
+std::string pipelinedRequests() {
+  return "GET /states?id=1 HTTP/1.1\r\n"
+         "Host: localhost\r\n"
+         "X-Device-ID:  Spotiled \r\n"
+         "\r\n"
+         "POST /button HTTP/1.1\r\n"
+         "Content-Type: application/json\r\n"
+         "Content-Length: 13\r\n"
+         "\r\n"
+         "{\"on\": true}\n"
+         "\r\n"
+         "GET /old HTTP/1.0\n"
+         "Connection: Keep-Alive\n"
+         "\n"
+         "DELETE /state HTTP/1.1\r\n"
+         "Connection: close\r\n"
+         "\r\n";
+}
+
+void testFragmentation() {
+  auto input = pipelinedRequests();
+  auto expected = std::vector<Parsed>{
+      {.method = http::Method::GET,
+       .url = "/states?id=1",
+       .headers = {{"host", "localhost"}, {"x-device-id", "Spotiled"}},
+       .keep_alive = true},
+      {.method = http::Method::POST,
+       .url = "/button",
+       .headers = {{"content-type", "application/json"}, {"content-length", "13"}},
+       .body = "{\"on\": true}\n",
+       .keep_alive = true},
+      {.method = http::Method::GET,
+       .url = "/old",
+       .headers = {{"connection", "Keep-Alive"}},
+       .keep_alive = true},
+      {.method = http::Method::DELETE,
+       .url = "/state",
+       .headers = {{"connection", "close"}},
+       .keep_alive = false},
+  };
+
+  for (size_t i = 0; i <= input.size(); ++i) {
+    for (size_t j = i; j <= input.size(); ++j) {
+      auto parser = std::make_unique<http::RequestParser>();
+      assert(parseAll(*parser, input, {i, j}) == expected);
+    }
+  }
+  auto byte_by_byte = std::vector<size_t>(input.size());
+  for (size_t i = 0; i < input.size(); ++i) {
+    byte_by_byte[i] = i;
+  }
+  auto parser = std::make_unique<http::RequestParser>();
+  assert(parseAll(*parser, input, byte_by_byte) == expected);
+  std::cout << "Parsed the same at every split of " << input.size() << " bytes" << std::endl;
+}
+
+void testLargeBody() {
+  auto body = std::string(3 * http::RequestParser::kBufferSize, 'b');
+  auto input = "PUT /upload HTTP/1.1\r\ncontent-length: " + std::to_string(body.size()) +
+               "\r\n\r\n" + body + "GET /after HTTP/1.1\r\n\r\n";
+
+  for (size_t split : {size_t(10), size_t(40), size_t(1000), input.size() - 5}) {
+    auto parser = std::make_unique<http::RequestParser>();
+    auto parsed = parseAll(*parser, input, {split});
+    assert(parsed.size() == 2);
+    assert(parsed[0].body == body);
+    assert(parsed[1].url == "/after");
+  }
+}
+
+void testStreamedBody() {
+  auto body = std::string();
+  for (size_t i = 0; i < 3 * http::RequestParser::kBufferSize; ++i) {
+    body += char('a' + i % 26);
+  }
+  auto input = "PUT /upload HTTP/1.1\r\ncontent-length: " + std::to_string(body.size()) +
+               "\r\n\r\n" + body + "GET /after HTTP/1.1\r\n\r\n";
+
+  for (size_t chunk_size : {size_t(1000), size_t(7000), input.size()}) {
+    auto parser = std::make_unique<http::RequestParser>();
+    auto streamed = std::string();
+    auto status = http::RequestParser::Status::kIncomplete;
+    size_t offset = 0;
+    while (status != http::RequestParser::Status::kComplete) {
+      auto buffer = parser->readBuffer();
+      auto n = std::min({buffer.size(), input.size() - offset, chunk_size});
+      std::memcpy(buffer.data(), input.data() + offset, n);
+      offset += n;
+      status = parser->parse(n);
+      if (parser->headComplete()) {
+        parser->streamBody();
+        streamed += parser->takeBody();
+        status = parser->parse(0);
+      }
+    }
+    assert(streamed == body);
+    assert(parser->body().empty());
+    parser->next();
+    auto rest = input.substr(offset);
+    std::memcpy(parser->readBuffer().data(), rest.data(), rest.size());
+    assert(parser->parse(rest.size()) == http::RequestParser::Status::kComplete);
+    assert(parser->url() == "/after");
+  }
+}
+
+void testErrors() {
+  for (std::string_view input : {
+           "GET\r\n\r\n",
+           "GET / HTTP/2\r\n\r\n",
+           "GET / HTTP/1.1\r\nbad\r\n\r\n",
+           "POST / HTTP/1.1\r\ncontent-length: x\r\n\r\n",
+       }) {
+    auto parser = std::make_unique<http::RequestParser>();
+    auto buffer = parser->readBuffer();
+    std::memcpy(buffer.data(), input.data(), input.size());
+    assert(parser->parse(input.size()) == http::RequestParser::Status::kError);
+  }
+  // Headers that don't fit the buffer.
+  auto parser = std::make_unique<http::RequestParser>();
+  auto input = "GET / HTTP/1.1\r\nx-long: " + std::string(http::RequestParser::kBufferSize, 'x');
+  auto status = http::RequestParser::Status::kIncomplete;
+  for (size_t offset = 0; status == http::RequestParser::Status::kIncomplete;) {
+    auto buffer = parser->readBuffer();
+    auto n = std::min(buffer.size(), input.size() - offset);
+    std::memcpy(buffer.data(), input.data() + offset, n);
+    offset += n;
+    status = parser->parse(n);
+  }
+  assert(status == http::RequestParser::Status::kHeadTooLarge);
+
+  parser = std::make_unique<http::RequestParser>();
+  input = "GET / HTTP/1.1\r\n";
+  for (size_t i = 0; i <= http::RequestParser::kMaxHeaders; ++i) {
+    input += "x-header: " + std::to_string(i) + "\r\n";
+  }
+  std::memcpy(parser->readBuffer().data(), input.data(), input.size());
+  assert(parser->parse(input.size()) == http::RequestParser::Status::kHeadTooLarge);
+}
+
+void bench() {
+  auto request = std::string(
+      "GET /spotify/now-playing?device=spotiled HTTP/1.1\r\n"
+      "Host: 192.168.1.20:8080\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+      "Accept-Language: en-US,en;q=0.5\r\n"
+      "Accept-Encoding: gzip, deflate\r\n"
+      "Connection: keep-alive\r\n"
+      "Cache-Control: no-cache\r\n"
+      "X-Device-ID: spotiled\r\n"
+      "\r\n");
+  auto input = std::string();
+  input.reserve(request.size() * kBenchRequests);
+  for (int i = 0; i < kBenchRequests; ++i) {
+    input += request;
+  }
+
+  for (auto copy : {false, true}) {
+    auto parser = std::make_unique<http::RequestParser>();
+    size_t num_parsed = 0, checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t offset = 0; offset < input.size();) {
+      auto buffer = parser->readBuffer();
+      auto n = std::min(buffer.size(), input.size() - offset);
+      std::memcpy(buffer.data(), input.data() + offset, n);
+      offset += n;
+      for (auto status = parser->parse(n); status == http::RequestParser::Status::kComplete;
+           status = parser->parse(0)) {
+        checksum += copy ? parser->request().headers.size() : parser->headers().size();
+        ++num_parsed;
+        parser->next();
+      }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    assert(num_parsed == kBenchRequests && checksum == 8 * num_parsed);
+    std::cout << (copy ? "parse and copy to http::Request: " : "parse: ")
+              << int(input.size() / elapsed.count() / (1024 * 1024)) << " MB/s, "
+              << int(num_parsed / elapsed.count()) << " requests/s" << std::endl;
+  }
+}
+
+}  // namespace
+
+int main() {
+  testFragmentation();
+  testLargeBody();
+  testStreamedBody();
+  testErrors();
+  bench();
+}
@@ -0,0 +1,94 @@
+#include "http/server/response_serializer.h"
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Checks the heads that responses are serialized to, and compares serializing the response to a
+// GET for a state on every request against sending one that was serialized when it changed.
+
+namespace {
+
+constexpr int kIterations = 1000000;
+
+std::string headOf(const http::Response &res, const http::ResponseFraming &framing) {
+  auto head = std::string();
+  http::serializeHead(res, framing, head);
+  return head;
+}
+
+void testHeads() {
+  assert(http::reasonPhrase(200) == "OK");
+  assert(http::reasonPhrase(431) == "Request Header Fields Too Large");
+  assert(http::reasonPhrase(299).empty());
+
+  assert(headOf(http::Response("hi"), {.keep_alive = true}) ==
+         "HTTP/1.1 200 OK\r\ncontent-type: text/html\r\ncontent-length: 2\r\n"
+         "connection: keep-alive\r\n\r\n");
+  assert(headOf(http::Response(299), {}) ==
+         "HTTP/1.1 299 \r\ncontent-type: text/html\r\ncontent-length: 0\r\n"
+         "connection: close\r\n\r\n");
+  // Neither a body nor a length for one.
+  assert(headOf(http::Response(204), {.keep_alive = true}) ==
+         "HTTP/1.1 204 No Content\r\nconnection: keep-alive\r\n\r\n");
+
+  // The framing headers of the response itself are replaced, and the response left as it was.
+  auto res = http::Response(200, {{"content-type", "application/json"},
+                                  {"transfer-encoding", "chunked"},
+                                  {"connection", "upgrade"}});
+  auto framing = http::framingFor(res, true, true, false);
+  assert(framing.keep_alive && framing.length_unknown && framing.chunked);
+  assert(headOf(res, framing) ==
+         "HTTP/1.1 200 OK\r\ncontent-type: application/json\r\ntransfer-encoding: chunked\r\n"
+         "connection: keep-alive\r\n\r\n");
+  assert(res.headers.size() == 3);
+  // Older clients read until the connection closes.
+  framing = http::framingFor(res, true, false, false);
+  assert(!framing.keep_alive && framing.length_unknown && !framing.chunked);
+  assert(headOf(res, framing).find("transfer-encoding") == std::string::npos);
+
+  auto cached = http::CachedResponse(http::Response("{}"));
+  assert(cached.bytes(true, false).ends_with("connection: keep-alive\r\n\r\n{}"));
+  assert(cached.bytes(false, false).ends_with("connection: close\r\n\r\n{}"));
+  assert(cached.bytes(true, true).ends_with("\r\n\r\n"));
+  assert(http::CachedResponse::withStatus(404)->bytes(true, false).starts_with("HTTP/1.1 404 "));
+  assert(!http::CachedResponse::withStatus(418));
+  std::cout << "Heads serialized as expected" << std::endl;
+}
+
+void benchStateGet() {
+  auto res = http::Response(R"({"temperature": 21.5, "humidity": 40, "battery": 87})");
+  auto framing = http::ResponseFraming{.keep_alive = true};
+  size_t total = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    auto bytes = std::string();
+    bytes.reserve(256 + res.body.size());
+    http::serializeHead(res, framing, bytes);
+    bytes += res.body;
+    total += bytes.size();
+  }
+  auto serialized = std::chrono::steady_clock::now() - start;
+
+  auto cached = http::CachedResponse(res);
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    total += cached.bytes(framing.keep_alive, false).size();
+  }
+  auto from_cache = std::chrono::steady_clock::now() - start;
+
+  auto ns = [](auto d) {
+    return std::chrono::duration<double, std::nano>(d).count() / kIterations;
+  };
+  std::cout << "State GET serialized per request: " << ns(serialized) << "ns, from cache "
+            << ns(from_cache) << "ns (" << total << " bytes)" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  testHeads();
+  benchStateGet();
+}
@@ -0,0 +1,252 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http/http.h"
+#include "http/server/server.h"
+
+// Checks that pipelined requests on one connection are answered in order, then loads the server
+// with clients that open a connection per request and with ones that keep them open, and reports
+// the requests per second of each, with one I/O thread and with several. Last, checks that requests
+// answered on the I/O thread don't wait for a busy main thread.
+
+namespace {
+
+constexpr int kPipelined = 50;
+constexpr int kClients = 8;
+constexpr int kRequestsPerClient = 500;
+constexpr int kIoThreads = 4;
+constexpr int kRoundTrips = 1000;
+constexpr auto kBusyTime = std::chrono::milliseconds{200};
+
+int connectTo(int port) {
+  auto fd = socket(AF_INET, SOCK_STREAM, 0);
+  auto addr = sockaddr_in{.sin_family = AF_INET, .sin_port = htons(port)};
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  auto err = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  assert(!err);
+  return fd;
+}
+
+// Everything the server sends until it closes the connection.
+std::string readAll(int fd) {
+  auto data = std::string();
+  char buffer[4096];
+  while (auto n = read(fd, buffer, sizeof(buffer))) {
+    assert(n > 0);
+    data.append(buffer, n);
+  }
+  return data;
+}
+
+// Splits off the body of the first response in data.
+std::string nextBody(std::string_view &data) {
+  assert(data.starts_with("HTTP/1.1 200"));
+  auto head_end = data.find("\r\n\r\n");
+  auto length_at = data.find("content-length: ");
+  assert(head_end != std::string_view::npos && length_at < head_end);
+  auto length = std::stoul(std::string(data.substr(length_at + 16)));
+  auto body = data.substr(head_end + 4, length);
+  data.remove_prefix(head_end + 4 + length);
+  return std::string(body);
+}
+
+// Sends a request and reads its response, on a connection that is kept open.
+std::string roundTrip(int fd, const std::string &request) {
+  assert(write(fd, request.data(), request.size()) == ssize_t(request.size()));
+  auto data = std::string();
+  char buffer[4096];
+  for (;;) {
+    auto n = read(fd, buffer, sizeof(buffer));
+    assert(n > 0);
+    data.append(buffer, n);
+    auto view = std::string_view(data);
+    auto head_end = view.find("\r\n\r\n");
+    auto length_at = view.find("content-length: ");
+    if (head_end != std::string_view::npos &&
+        data.size() >= head_end + 4 + std::stoul(std::string(view.substr(length_at + 16)))) {
+      return nextBody(view);
+    }
+  }
+}
+
+void testPipelining(int port) {
+  auto requests = std::string();
+  for (int i = 0; i < kPipelined; ++i) {
+    auto last = i == kPipelined - 1;
+    if (i % 2) {
+      auto body = "body" + std::to_string(i);
+      requests += "POST /" + std::to_string(i) + " HTTP/1.1\r\ncontent-length: " +
+                  std::to_string(body.size()) + (last ? "\r\nconnection: close" : "") +
+                  "\r\n\r\n" + body;
+    } else {
+      requests += "GET /" + std::to_string(i) + " HTTP/1.1" +
+                  (last ? "\r\nconnection: close" : "") + "\r\n\r\n";
+    }
+  }
+  auto fd = connectTo(port);
+  // In one go, so that the server reads several requests at once.
+  assert(write(fd, requests.data(), requests.size()) == ssize_t(requests.size()));
+  auto responses = readAll(fd);
+  close(fd);
+
+  auto data = std::string_view(responses);
+  for (int i = 0; i < kPipelined; ++i) {
+    auto expected = "/" + std::to_string(i) + (i % 2 ? "body" + std::to_string(i) : "");
+    assert(nextBody(data) == expected);
+  }
+  assert(data.empty());
+  std::cout << kPipelined << " pipelined requests answered in order" << std::endl;
+}
+
+void testHttp10(int port) {
+  auto fd = connectTo(port);
+  auto request = std::string("GET /old HTTP/1.0\r\n\r\n");
+  assert(write(fd, request.data(), request.size()) == ssize_t(request.size()));
+  // Without keep-alive the server closes the connection after answering.
+  auto response = readAll(fd);
+  close(fd);
+  auto data = std::string_view(response);
+  assert(nextBody(data) == "/old");
+}
+
+double load(http::Http &http, async::Scheduler &scheduler, std::string url, bool keep_alive) {
+  auto headers = keep_alive ? http::Headers() : http::Headers{{"connection", "close"}};
+  std::atomic_int num_done = 0;
+  std::promise<void> done;
+  std::vector<http::Lifetime> requests(kClients);
+  std::vector<int> num_sent(kClients);
+
+  std::function<void(int)> send = [&](int client) {
+    if (num_sent[client]++ == kRequestsPerClient) {
+      if (++num_done == kClients) {
+        done.set_value();
+      }
+      return;
+    }
+    requests[client] = http.request(
+        {.url = url, .headers = headers},
+        {.post_to = scheduler, .on_response = [&, client](http::Response res) {
+           assert(res.status == 200);
+           send(client);
+         }});
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  auto _ = scheduler.schedule([&] {
+    for (int client = 0; client < kClients; ++client) {
+      send(client);
+    }
+  });
+  done.get_future().get();
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  std::promise<void> released;
+  auto release = scheduler.schedule([&] {
+    requests.clear();
+    released.set_value();
+  });
+  released.get_future().get();
+  return kClients * kRequestsPerClient / elapsed.count();
+}
+
+std::unique_ptr<http::Server> startServer(async::Scheduler &scheduler,
+                                          const http::ServerConfig &config) {
+  std::unique_ptr<http::Server> server;
+  std::promise<void> started;
+  auto _ = scheduler.schedule([&] {
+    server = http::makeServer(
+        scheduler, [](http::Request req) { return http::Response(req.url + req.body); }, config);
+    started.set_value();
+  });
+  started.get_future().get();
+  return server;
+}
+
+void stopServer(async::Scheduler &scheduler, std::unique_ptr<http::Server> server) {
+  std::promise<void> stopped;
+  auto _ = scheduler.schedule([&] {
+    server.reset();
+    stopped.set_value();
+  });
+  stopped.get_future().get();
+}
+
+void testFastHandler(async::Scheduler &scheduler) {
+  auto fast = std::make_shared<const http::CachedResponse>(http::Response("fast"));
+  auto fast_handler = [fast](const http::Request &req) {
+    return req.url == "/fast" ? fast : nullptr;
+  };
+  auto server = startServer(scheduler, {.port = 0, .fast_handler = fast_handler});
+  auto fd = connectTo(server->port());
+  auto roundTripTime = [&](std::string path, std::string expected) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRoundTrips; ++i) {
+      assert(roundTrip(fd, "GET " + path + " HTTP/1.1\r\n\r\n") == expected);
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start) /
+           kRoundTrips;
+  };
+  std::cout << "round trip on the I/O thread: " << roundTripTime("/fast", "fast").count()
+            << "us, through the main thread: " << roundTripTime("/slow", "/slow").count() << "us"
+            << std::endl;
+
+  std::promise<void> busy;
+  auto _ = scheduler.schedule([&] {
+    busy.set_value();
+    std::this_thread::sleep_for(kBusyTime);
+  });
+  busy.get_future().get();
+  auto start = std::chrono::steady_clock::now();
+  assert(roundTrip(fd, "GET /fast HTTP/1.1\r\n\r\n") == "fast");
+  assert(std::chrono::steady_clock::now() - start < kBusyTime / 2);
+  std::cout << "Answered while the main thread was busy" << std::endl;
+
+  close(fd);
+  stopServer(scheduler, std::move(server));
+}
+
+}  // namespace
+
+int main() {
+  auto main_thread = async::Thread::create("main");
+  auto client_thread = async::Thread::create("client");
+  auto &main_scheduler = main_thread->scheduler();
+
+  auto configs = std::vector<http::ServerConfig>{
+      {.port = 0},
+      {.port = 0, .io_threads = kIoThreads},
+      {.port = 0, .io_threads = kIoThreads, .reuse_port = true},
+  };
+  for (auto &config : configs) {
+    auto server = startServer(main_scheduler, config);
+    std::cout << config.io_threads << " I/O threads"
+              << (config.reuse_port ? " with SO_REUSEPORT" : "") << std::endl;
+    testPipelining(server->port());
+    testHttp10(server->port());
+
+    auto url = "http://127.0.0.1:" + std::to_string(server->port()) + "/load";
+    for (auto keep_alive : {false, true}) {
+      auto http = http::Http::create();
+      auto rate = load(*http, client_thread->scheduler(), url, keep_alive);
+      auto stats = http->stats();
+      std::cout << (keep_alive ? "keep-alive" : "connection per request") << ": " << int(rate)
+                << " requests/s, " << stats.new_connections << " connections" << std::endl;
+      assert(keep_alive ? stats.new_connections <= kClients
+                        : stats.new_connections == kClients * kRequestsPerClient);
+    }
+    stopServer(main_scheduler, std::move(server));
+  }
+  testFastHandler(main_scheduler);
+}
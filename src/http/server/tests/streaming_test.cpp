@@ -0,0 +1,199 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "http/http.h"
+#include "http/server/server.h"
+
+// Streams a response of unknown length from a handler, directly and through a proxy that passes
+// it on as it arrives, and a large request body to a streaming handler, checking that both arrive
+// whole and in pieces.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr auto kPieces = std::array<std::string_view, 3>{"second,", "third,", "last"};
+constexpr auto kExpectedBody = "first,second,third,last";
+constexpr size_t kUploadSize = 1024 * 1024;
+
+int connectTo(int port) {
+  auto fd = socket(AF_INET, SOCK_STREAM, 0);
+  auto addr = sockaddr_in{.sin_family = AF_INET, .sin_port = htons(port)};
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  auto err = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  assert(!err);
+  return fd;
+}
+
+void send(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto n = write(fd, data.data(), data.size());
+    assert(n > 0);
+    data.remove_prefix(n);
+  }
+}
+
+// Reads until |data| ends with |end|, or until the server closes the connection.
+std::string readUntil(int fd, std::string_view end = {}) {
+  auto data = std::string();
+  char buffer[4096];
+  while (end.empty() || !data.ends_with(end)) {
+    auto n = read(fd, buffer, sizeof(buffer));
+    assert(n >= 0);
+    if (!n) {
+      break;
+    }
+    data.append(buffer, n);
+  }
+  return data;
+}
+
+std::unique_ptr<http::Server> startServer(async::Scheduler &scheduler,
+                                          http::RequestHandler handler) {
+  std::unique_ptr<http::Server> server;
+  std::promise<void> started;
+  auto _ = scheduler.schedule([&] {
+    server = http::makeServer(scheduler, std::move(handler), {.port = 0});
+    started.set_value();
+  });
+  started.get_future().get();
+  return server;
+}
+
+void stopServer(async::Scheduler &scheduler, std::unique_ptr<http::Server> server) {
+  std::promise<void> stopped;
+  auto _ = scheduler.schedule([&] {
+    server.reset();
+    stopped.set_value();
+  });
+  stopped.get_future().get();
+}
+
+// Answers with the start of the body right away, and the rest in pieces a while later.
+http::AsyncHandler unknownLengthHandler(async::Scheduler &scheduler) {
+  return [&scheduler](http::Request, http::RequestOptions opts) -> http::Lifetime {
+    opts.on_response(http::Response(200, {{"transfer-encoding", "chunked"}}, "first,"));
+    auto work = std::make_shared<std::vector<async::Lifetime>>();
+    for (size_t i = 0; i <= kPieces.size(); ++i) {
+      work->push_back(scheduler.schedule(
+          [opts, i] {
+            i < kPieces.size() ? opts.on_bytes(0, kPieces[i], nullptr) : opts.on_done();
+          },
+          {.delay = (i + 1) * 10ms}));
+    }
+    return work;
+  };
+}
+
+std::string fetch(http::Http &http, async::Scheduler &scheduler, std::string url) {
+  std::promise<std::string> body;
+  auto request = http.request({.url = std::move(url)},
+                              {.post_to = scheduler, .on_response = [&](http::Response res) {
+                                 assert(res.status == 200);
+                                 body.set_value(std::move(res.body));
+                               }});
+  return body.get_future().get();
+}
+
+void testUnknownLength(async::Scheduler &scheduler, http::Http &http) {
+  auto server = startServer(scheduler, unknownLengthHandler(scheduler));
+
+  // Chunked, on a connection that is kept open for another request.
+  auto fd = connectTo(server->port());
+  for (int i = 0; i < 2; ++i) {
+    send(fd, "GET / HTTP/1.1\r\n\r\n");
+    auto response = readUntil(fd, "0\r\n\r\n");
+    assert(response.find("transfer-encoding: chunked\r\n") != std::string::npos);
+    assert(response.find("content-length") == std::string::npos);
+    assert(response.ends_with("\r\n\r\n6\r\nfirst,\r\n7\r\nsecond,\r\n6\r\nthird,\r\n4\r\nlast\r\n"
+                              "0\r\n\r\n"));
+  }
+  close(fd);
+
+  // Older clients get the body as is, until the connection closes.
+  fd = connectTo(server->port());
+  send(fd, "GET / HTTP/1.0\r\n\r\n");
+  auto response = readUntil(fd);
+  close(fd);
+  assert(response.find("transfer-encoding") == std::string::npos);
+  assert(response.ends_with(std::string("\r\n\r\n") + kExpectedBody));
+
+  auto url = "http://127.0.0.1:" + std::to_string(server->port());
+  assert(fetch(http, scheduler, url) == kExpectedBody);
+
+  // Through a proxy, which forwards the pieces as they come.
+  auto proxy = startServer(
+      scheduler, http::AsyncHandler([&](http::Request req, http::RequestOptions opts) {
+        req.url = url + req.url;
+        return http.request(std::move(req), std::move(opts));
+      }));
+  assert(fetch(http, scheduler, "http://127.0.0.1:" + std::to_string(proxy->port())) ==
+         kExpectedBody);
+  std::cout << "Body of unknown length sent chunked, as is, and through a proxy" << std::endl;
+
+  stopServer(scheduler, std::move(proxy));
+  stopServer(scheduler, std::move(server));
+}
+
+void testStreamedRequestBody(async::Scheduler &scheduler) {
+  auto body = std::string(kUploadSize, '\0');
+  for (size_t i = 0; i < body.size(); ++i) {
+    body[i] = char(i * 31 + (i >> 12));
+  }
+  size_t num_pieces = 0, max_piece = 0;
+  auto received = std::string();
+  auto server = startServer(
+      scheduler, http::StreamingHandler([&](http::Request req, http::RequestOptions opts,
+                                            http::OnRequestBody &on_body) -> http::Lifetime {
+        assert(req.body.empty());
+        on_body = [&, opts, url = req.url](std::string_view piece, http::Lifetime) {
+          if (!piece.empty()) {
+            ++num_pieces;
+            max_piece = std::max(max_piece, piece.size());
+            received += piece;
+            return;
+          }
+          assert(received.empty() || received == body);
+          opts.on_response(http::Response(url + " " + std::to_string(received.size())));
+          received.clear();
+        };
+        return nullptr;
+      }));
+
+  auto fd = connectTo(server->port());
+  // The body of the first request is streamed while the second waits behind it.
+  send(fd, "POST /upload HTTP/1.1\r\ncontent-length: " + std::to_string(body.size()) + "\r\n\r\n");
+  send(fd, body);
+  send(fd, "GET /after HTTP/1.1\r\nconnection: close\r\n\r\n");
+  auto responses = readUntil(fd);
+  close(fd);
+
+  assert(responses.find("/upload " + std::to_string(kUploadSize)) != std::string::npos);
+  assert(responses.ends_with("/after 0"));
+  assert(num_pieces > 1);
+  std::cout << "Streamed a " << kUploadSize / 1024 << "KiB request body in " << num_pieces
+            << " pieces of up to " << max_piece << " bytes" << std::endl;
+
+  stopServer(scheduler, std::move(server));
+}
+
+}  // namespace
+
+int main() {
+  auto main_thread = async::Thread::create("main");
+  auto http = http::Http::create();
+
+  testUnknownLength(main_thread->scheduler(), *http);
+  testStreamedRequestBody(main_thread->scheduler());
+}
@@ -0,0 +1,208 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http/server/server.h"
+
+// Misbehaves towards a server with low limits the way a broken or hostile client on the network
+// would: floods it with connections, sends requests slowly or not at all, sends oversized heads
+// and bodies, and doesn't read responses. Checks that each is turned away and counted, that the
+// server still answers afterwards, and reports how quickly connections are rejected.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr int kMaxConnections = 16;
+constexpr int kFloodConnections = 64;
+constexpr int kSlowClients = 8;
+constexpr auto kTimeout = 300ms;
+constexpr size_t kMaxBodySize = 64 * 1024;
+constexpr size_t kBigResponseSize = 64 * 1024 * 1024;
+
+int connectTo(int port) {
+  auto fd = socket(AF_INET, SOCK_STREAM, 0);
+  auto addr = sockaddr_in{.sin_family = AF_INET, .sin_port = htons(port)};
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  auto err = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  assert(!err);
+  auto timeout = timeval{.tv_sec = 5};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return fd;
+}
+
+// Stops once the server has closed the connection.
+void send(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto n = write(fd, data.data(), data.size());
+    if (n <= 0) {
+      return;
+    }
+    data.remove_prefix(n);
+  }
+}
+
+// Reads until the server closes the connection.
+std::string readAll(int fd) {
+  auto data = std::string();
+  char buffer[4096];
+  for (ssize_t n; (n = read(fd, buffer, sizeof(buffer))) > 0;) {
+    data.append(buffer, n);
+  }
+  return data;
+}
+
+void waitFor(std::function<bool()> condition) {
+  for (auto start = std::chrono::steady_clock::now(); !condition();) {
+    assert(std::chrono::steady_clock::now() - start < 5s);
+    std::this_thread::sleep_for(10ms);
+  }
+}
+
+long residentKiB() {
+  auto status = std::ifstream("/proc/self/status");
+  for (std::string line; std::getline(status, line);) {
+    if (line.starts_with("VmRSS:")) {
+      return std::stol(line.substr(6));
+    }
+  }
+  return 0;
+}
+
+void testFlood(http::Server &server) {
+  auto fds = std::vector<int>();
+  for (int i = 0; i < kFloodConnections; ++i) {
+    fds.push_back(connectTo(server.port()));
+  }
+  // The first connections are accepted and sit idle, the rest are turned away right away.
+  auto start = std::chrono::steady_clock::now();
+  for (int i = kMaxConnections; i < kFloodConnections; ++i) {
+    assert(readAll(fds[i]).starts_with("HTTP/1.1 503 "));
+  }
+  auto elapsed =
+      std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+  auto stats = server.stats();
+  assert(stats.connections_rejected == kFloodConnections - kMaxConnections);
+  assert(stats.open_connections == kMaxConnections);
+  std::cout << "Rejected " << stats.connections_rejected << " connections over the limit, "
+            << elapsed.count() / stats.connections_rejected << "us each" << std::endl;
+
+  // Idle connections are closed once the request timeout is up, without counting as timeouts.
+  for (int i = 0; i < kMaxConnections; ++i) {
+    assert(readAll(fds[i]).empty());
+  }
+  for (auto fd : fds) {
+    close(fd);
+  }
+  waitFor([&] { return server.stats().open_connections == 0; });
+  assert(server.stats().request_timeouts == 0);
+}
+
+void testSlowClients(http::Server &server) {
+  auto fds = std::vector<int>();
+  for (int i = 0; i < kSlowClients; ++i) {
+    fds.push_back(connectTo(server.port()));
+    send(fds.back(), "GET / HTTP/1.1\r\nx-slow: ");
+  }
+  // A byte at a time doesn't keep the connection open past the deadline.
+  for (auto i = 0; i < 2 * kTimeout / 20ms; ++i) {
+    for (auto fd : fds) {
+      send(fd, "x");
+    }
+    std::this_thread::sleep_for(20ms);
+  }
+  for (auto fd : fds) {
+    readAll(fd);
+    close(fd);
+  }
+  assert(server.stats().request_timeouts == kSlowClients);
+  std::cout << "Closed " << kSlowClients << " connections sending their request too slowly"
+            << std::endl;
+}
+
+void testOversized(http::Server &server) {
+  auto request = [&](std::string data) {
+    auto fd = connectTo(server.port());
+    send(fd, data);
+    auto response = readAll(fd);
+    close(fd);
+    return response;
+  };
+  assert(request("GET / HTTP/1.1\r\nx-long: " + std::string(32 * 1024, 'x') + "\r\n\r\n")
+             .starts_with("HTTP/1.1 431 "));
+  // Answered without waiting for, or making room for, the body.
+  assert(request("POST / HTTP/1.1\r\ncontent-length: 1000000000\r\n\r\n")
+             .starts_with("HTTP/1.1 413 "));
+  // The request before a bad one is still answered.
+  auto responses = request("GET / HTTP/1.1\r\n\r\nNONSENSE\r\n\r\n");
+  assert(responses.starts_with("HTTP/1.1 200 "));
+  assert(responses.find("HTTP/1.1 400 ") != std::string::npos);
+
+  auto stats = server.stats();
+  assert(stats.heads_too_large == 1 && stats.bodies_too_large == 1 && stats.bad_requests == 1);
+  std::cout << "Answered an oversized head, an oversized body and a bad request" << std::endl;
+}
+
+void testSlowReader(http::Server &server) {
+  auto fd = connectTo(server.port());
+  send(fd, "GET /big HTTP/1.1\r\n\r\n");
+  waitFor([&] { return server.stats().write_timeouts == 1; });
+  close(fd);
+  std::cout << "Gave up on a response that wasn't read" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  // Writes to connections that the server has closed fail rather than end the test.
+  signal(SIGPIPE, SIG_IGN);
+  auto main_thread = async::Thread::create("main");
+  auto &main_scheduler = main_thread->scheduler();
+
+  std::unique_ptr<http::Server> server;
+  std::promise<void> started;
+  auto _ = main_scheduler.schedule([&] {
+    server = http::makeServer(main_scheduler, http::SyncHandler([](http::Request req) {
+                                return req.url == "/big"
+                                           ? http::Response(std::string(kBigResponseSize, 'x'))
+                                           : http::Response("ok");
+                              }),
+                              {.port = 0,
+                               .max_connections = kMaxConnections,
+                               .max_body_size = kMaxBodySize,
+                               .request_timeout = kTimeout,
+                               .io_timeout = kTimeout});
+    started.set_value();
+  });
+  started.get_future().get();
+
+  testFlood(*server);
+  testSlowClients(*server);
+  testOversized(*server);
+  testSlowReader(*server);
+
+  // Still serving.
+  auto fd = connectTo(server->port());
+  send(fd, "GET / HTTP/1.1\r\nconnection: close\r\n\r\n");
+  assert(readAll(fd).ends_with("\r\n\r\nok"));
+  close(fd);
+  std::cout << "Resident after the stress: " << residentKiB() / 1024 << "MiB" << std::endl;
+
+  std::promise<void> stopped;
+  auto stop = main_scheduler.schedule([&] {
+    server.reset();
+    stopped.set_value();
+  });
+  stopped.get_future().get();
+}
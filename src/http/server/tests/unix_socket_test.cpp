@@ -0,0 +1,154 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "http/server/server.h"
+
+// Posts small state updates the way a daemon on the same machine would, over loopback TCP and
+// over the server's Unix domain socket, and compares the round trip time and the CPU time spent
+// per request, by client and server together.
+
+namespace {
+
+constexpr auto kSocketPath = "/tmp/led-client-unix-socket-test.sock";
+constexpr int kRequests = 20000;
+
+int connectTcp(int port) {
+  auto fd = socket(AF_INET, SOCK_STREAM, 0);
+  auto addr = sockaddr_in{.sin_family = AF_INET, .sin_port = htons(port)};
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  auto err = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  assert(!err);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+int connectUnix(const char *path) {
+  auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  auto addr = sockaddr_un{.sun_family = AF_UNIX};
+  std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  auto err = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  assert(!err);
+  return fd;
+}
+
+void send(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto n = write(fd, data.data(), data.size());
+    assert(n > 0);
+    data.remove_prefix(n);
+  }
+}
+
+// Reads one response with a body of |body_size| bytes.
+void readResponse(int fd, std::string &buffer, size_t body_size) {
+  buffer.clear();
+  char chunk[1024];
+  for (size_t end = std::string::npos;
+       end == std::string::npos || buffer.size() < end + 4 + body_size;
+       end = buffer.find("\r\n\r\n")) {
+    auto n = read(fd, chunk, sizeof(chunk));
+    assert(n > 0);
+    buffer.append(chunk, n);
+  }
+  assert(buffer.starts_with("HTTP/1.1 200 "));
+}
+
+std::chrono::microseconds cpuTime() {
+  auto usage = rusage{};
+  getrusage(RUSAGE_SELF, &usage);
+  auto total = [](timeval t) {
+    return std::chrono::seconds{t.tv_sec} + std::chrono::microseconds{t.tv_usec};
+  };
+  return total(usage.ru_utime) + total(usage.ru_stime);
+}
+
+void bench(const char *name, int fd) {
+  auto body = std::string(R"({"temperature": 21.5, "humidity": 40, "battery": 87})");
+  auto request = "POST /sensor/livingroom HTTP/1.1\r\nhost: localhost\r\n"
+                 "content-type: application/json\r\ncontent-length: " +
+                 std::to_string(body.size()) + "\r\n\r\n" + body;
+  auto buffer = std::string();
+  auto round_trips = std::vector<std::chrono::nanoseconds>();
+  round_trips.reserve(kRequests);
+
+  auto cpu_start = cpuTime();
+  for (int i = 0; i < kRequests; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    send(fd, request);
+    readResponse(fd, buffer, 2);
+    round_trips.push_back(std::chrono::steady_clock::now() - start);
+  }
+  auto cpu = cpuTime() - cpu_start;
+
+  std::sort(round_trips.begin(), round_trips.end());
+  auto us = [](std::chrono::nanoseconds d) { return d.count() / 1000.0; };
+  std::cout << name << ": p50 " << us(round_trips[kRequests / 2]) << "us, p99 "
+            << us(round_trips[kRequests * 99 / 100]) << "us, CPU "
+            << double(cpu.count()) / kRequests << "us per request" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  auto main_thread = async::Thread::create("main");
+  auto &main_scheduler = main_thread->scheduler();
+
+  // A socket left behind by an earlier run is replaced.
+  if (!std::filesystem::exists(kSocketPath)) {
+    auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    auto addr = sockaddr_un{.sun_family = AF_UNIX};
+    std::strncpy(addr.sun_path, kSocketPath, sizeof(addr.sun_path) - 1);
+    bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    close(fd);
+  }
+
+  std::unique_ptr<http::Server> server;
+  std::promise<void> started;
+  auto _ = main_scheduler.schedule([&] {
+    server = http::makeServer(
+        main_scheduler, http::SyncHandler([](http::Request req) {
+          assert(req.method == http::Method::POST && !req.body.empty());
+          return http::Response("ok");
+        }),
+        {.port = 0, .unix_socket = kSocketPath, .unix_socket_mode = 0600});
+    started.set_value();
+  });
+  started.get_future().get();
+
+  auto perms = std::filesystem::status(kSocketPath).permissions();
+  assert(perms == (std::filesystem::perms::owner_read | std::filesystem::perms::owner_write));
+
+  auto tcp_fd = connectTcp(server->port());
+  auto unix_fd = connectUnix(kSocketPath);
+  // Taking turns, so that both see the same load on the machine.
+  for (int round = 0; round < 3; ++round) {
+    bench("loopback TCP", tcp_fd);
+    bench("Unix socket", unix_fd);
+  }
+  close(tcp_fd);
+  close(unix_fd);
+
+  std::promise<void> stopped;
+  auto stop = main_scheduler.schedule([&] {
+    server.reset();
+    stopped.set_value();
+  });
+  stopped.get_future().get();
+  assert(!std::filesystem::exists(kSocketPath));
+}
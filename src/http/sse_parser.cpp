@@ -0,0 +1,81 @@
+#include "sse_parser.h"
+
+#include <charconv>
+#include <utility>
+
+namespace http {
+
+SseParser::SseParser(OnEvent on_event) : _on_event{std::move(on_event)} {}
+
+void SseParser::feed(std::string_view input) {
+  while (!input.empty()) {
+    if (std::exchange(_skip_lf, false) && input.front() == '\n') {
+      input.remove_prefix(1);
+      continue;
+    }
+    auto end = input.find_first_of("\r\n");
+    if (end == std::string_view::npos) {
+      _line += input;
+      return;
+    }
+    _skip_lf = input[end] == '\r';
+    if (_line.empty()) {
+      onLine(input.substr(0, end));
+    } else {
+      _line += input.substr(0, end);
+      onLine(_line);
+      _line.clear();
+    }
+    input.remove_prefix(end + 1);
+  }
+}
+
+void SseParser::reset() {
+  _line.clear();
+  _skip_lf = false;
+  _type.clear();
+  _data.clear();
+}
+
+void SseParser::onLine(std::string_view line) {
+  if (line.empty()) {
+    return dispatch();
+  }
+  auto colon = line.find(':');
+  if (colon == 0) {
+    return;  // comment, usually a keep-alive
+  }
+  auto field = line.substr(0, colon);
+  auto value = colon == std::string_view::npos ? std::string_view() : line.substr(colon + 1);
+  if (value.starts_with(' ')) {
+    value.remove_prefix(1);
+  }
+
+  if (field == "data") {
+    _data += value;
+    _data += '\n';
+  } else if (field == "event") {
+    _type = value;
+  } else if (field == "id") {
+    if (value.find('\0') == std::string_view::npos) {
+      _last_event_id = value;
+    }
+  } else if (field == "retry") {
+    int64_t retry_ms = 0;
+    if (std::from_chars(value.data(), value.data() + value.size(), retry_ms).ec == std::errc{}) {
+      _retry_ms = retry_ms;
+    }
+  }
+}
+
+void SseParser::dispatch() {
+  if (!_data.empty()) {
+    _data.pop_back();
+    auto type = _type.empty() ? std::string_view("message") : std::string_view(_type);
+    _on_event({.id = _last_event_id, .type = type, .data = _data});
+  }
+  _type.clear();
+  _data.clear();
+}
+
+}  // namespace http
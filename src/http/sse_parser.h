@@ -0,0 +1,44 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace http {
+
+// Incremental parser for text/event-stream bodies. Input may be split anywhere, including in the
+// middle of a line ending.
+class SseParser final {
+ public:
+  struct Event {
+    std::string_view id;
+    std::string_view type;
+    std::string_view data;
+  };
+  using OnEvent = std::function<void(const Event &)>;
+
+  explicit SseParser(OnEvent);
+
+  void feed(std::string_view);
+  void reset();
+
+  // Of the last event that set one, to resume from when reconnecting.
+  const std::string &lastEventId() const { return _last_event_id; }
+  // Reconnection delay asked for by the server, or -1.
+  int64_t retryMs() const { return _retry_ms; }
+
+ private:
+  void onLine(std::string_view);
+  void dispatch();
+
+  OnEvent _on_event;
+  std::string _line;
+  bool _skip_lf = false;
+
+  std::string _type;
+  std::string _data;
+  std::string _last_event_id;
+  int64_t _retry_ms = -1;
+};
+
+}  // namespace http
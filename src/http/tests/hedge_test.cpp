@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "http/http.h"
+#include "http/server/server.h"
+
+// Requests from a local server that answers quickly but leaves every few requests hanging, as a
+// stalled connection would. Checks that timeouts turn into 504s, and compares the tail latency of
+// plain and hedged requests. Then checks that hedged requests are rarely sent twice while the
+// server answers all of them quickly.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr auto kFastDelay = 5ms;
+constexpr auto kStallDelay = 2s;
+constexpr int kStallEvery = 25;
+constexpr int kRequests = 100;
+
+}  // namespace
+
+int main() {
+  auto main_thread = async::Thread::create("main");
+  auto &main_scheduler = main_thread->scheduler();
+
+  int num_received = 0;
+  // Stalled responses that are still to be sent when the test ends.
+  std::vector<async::Lifetime> stalls;
+  std::unique_ptr<http::Server> server;
+  std::promise<void> started;
+  auto _ = main_scheduler.schedule([&] {
+    auto handler = [&](http::Request req, http::RequestOptions opts) {
+      auto stall = req.url.ends_with("/stall") ||
+                   (!req.url.ends_with("/steady") && ++num_received % kStallEvery == 0);
+      auto delay = stall ? std::chrono::milliseconds{kStallDelay}
+                         : std::chrono::milliseconds{kFastDelay};
+      auto work = main_scheduler.schedule([on_response = opts.on_response] { on_response(200); },
+                                          {.delay = delay});
+      if (stall) {
+        stalls.push_back(work);
+      }
+      return work;
+    };
+    server = http::makeServer(main_scheduler, handler, {.port = 0});
+    started.set_value();
+  });
+  started.get_future().get();
+
+  auto http = http::Http::create();
+  auto url = "http://127.0.0.1:" + std::to_string(server->port());
+
+  auto fetch = [&](std::string path, http::RequestOptions opts) {
+    std::promise<int> status;
+    opts.on_response = [&](http::Response res) { status.set_value(res.status); };
+    auto start = std::chrono::steady_clock::now();
+    auto request = http->request({.url = url + path}, std::move(opts));
+    auto result = status.get_future().get();
+    return std::make_pair(result, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                      std::chrono::steady_clock::now() - start));
+  };
+
+  {
+    auto [status, elapsed] = fetch("/stall", {.post_to = main_scheduler, .timeout = 100ms});
+    assert(status == 504);
+    assert(elapsed < kStallDelay);
+    std::cout << "stalled request timed out after " << elapsed.count() << "ms" << std::endl;
+  }
+
+  for (auto hedge : {false, true}) {
+    auto latencies = std::vector<std::chrono::milliseconds>();
+    for (int i = 0; i < kRequests; ++i) {
+      auto [status, elapsed] = fetch("/", {.post_to = main_scheduler, .hedge = hedge});
+      assert(status == 200);
+      latencies.push_back(elapsed);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << (hedge ? "hedged" : "plain") << ": p50 " << latencies[kRequests / 2].count()
+              << "ms, p99 " << latencies[kRequests * 99 / 100].count() << "ms, max "
+              << latencies.back().count() << "ms" << std::endl;
+    if (hedge) {
+      assert(latencies.back() < kStallDelay);
+    }
+  }
+
+  auto stats = http->stats();
+  std::cout << stats.timeouts << " timed out, " << stats.hedges << " hedged" << std::endl;
+  assert(stats.timeouts == 1);
+  assert(stats.hedges > 0);
+
+  for (int i = 0; i < kRequests; ++i) {
+    auto [status, elapsed] = fetch("/steady", {.post_to = main_scheduler, .hedge = true});
+    assert(status == 200);
+  }
+  auto steady_hedges = http->stats().hedges - stats.hedges;
+  std::cout << "steady: " << steady_hedges << " of " << kRequests << " hedged" << std::endl;
+  assert(steady_hedges <= kRequests / 10);
+
+  std::promise<void> stopped;
+  auto stop = main_scheduler.schedule([&] {
+    stalls.clear();
+    server.reset();
+    stopped.set_value();
+  });
+  stopped.get_future().get();
+}
@@ -21,17 +21,22 @@ int main() {
       {
           .url = "https://google.com",
       },
-      {.post_to = res->scheduler(), .callback = callback});
+      {.post_to = res->scheduler(), .on_response = callback});
   printf("request#2\n");
   auto req2 = http->request(
       {
           .url = "https://bing.com",
       },
-      {.post_to = res->scheduler(), .callback = callback});
+      {.post_to = res->scheduler(), .on_response = callback});
 
   done.get_future().get();
   printf("done\n");
 
+  auto stats = http->stats();
+  printf("%d requests, %d new connections (%dus), %d reused\n", int(stats.requests),
+         int(stats.new_connections), int(stats.handshake_time.count()),
+         int(stats.reused_connections));
+
   //
   return 0;
 }
@@ -0,0 +1,97 @@
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "http/http.h"
+#include "http/server/server.h"
+
+// Streams multi-MB responses from a local server through consumers that hold on to each chunk for
+// a while, as when forwarding it to a slower peer, and reports the throughput per slot count.
+
+namespace {
+
+constexpr size_t kBodySize = 8 * 1024 * 1024;
+constexpr auto kHoldTime = std::chrono::microseconds{20};
+constexpr int kRuns = 3;
+
+void busyWait(std::chrono::microseconds duration) {
+  auto until = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < until) {
+  }
+}
+
+}  // namespace
+
+int main() {
+  auto main_thread = async::Thread::create("main");
+  auto sink_thread = async::Thread::create("sink");
+  auto &main_scheduler = main_thread->scheduler();
+  auto &sink_scheduler = sink_thread->scheduler();
+
+  auto body = std::string(kBodySize, '\0');
+  for (size_t i = 0; i < body.size(); ++i) {
+    body[i] = char(i * 31 + (i >> 12));
+  }
+
+  std::unique_ptr<http::Server> server;
+  std::promise<void> started;
+  auto _ = main_scheduler.schedule([&] {
+    server = http::makeServer(
+        main_scheduler, [&](http::Request) { return http::Response(body); }, {.port = 0});
+    started.set_value();
+  });
+  started.get_future().get();
+
+  auto http = http::Http::create();
+  auto url = "http://127.0.0.1:" + std::to_string(server->port());
+
+  for (size_t slots : {1, 2, 4, 8}) {
+    auto best = std::chrono::duration<double>::max();
+
+    for (int run = 0; run < kRuns; ++run) {
+      std::promise<void> done;
+      int64_t received = 0;
+      std::vector<async::Lifetime> work;
+
+      auto start = std::chrono::steady_clock::now();
+      auto request = http->request(
+          {.url = url},
+          {.post_to = main_scheduler,
+           .on_response = [&](http::Response res) { assert(res.status == 200); },
+           .on_bytes =
+               [&](int64_t offset, std::string_view data, http::Lifetime lifetime) {
+                 assert(offset == received);
+                 assert(data == std::string_view(body).substr(offset, data.size()));
+                 received += data.size();
+                 // Chunks are released in order from another thread, like the server does.
+                 work.push_back(sink_scheduler.schedule([lifetime = std::move(lifetime)] {
+                   busyWait(kHoldTime);
+                 }));
+                 if (received == kBodySize) {
+                   done.set_value();
+                 }
+               },
+           .stream_slots = slots});
+
+      done.get_future().get();
+      best = std::min<std::chrono::duration<double>>(best,
+                                                     std::chrono::steady_clock::now() - start);
+      std::promise<void> drained;
+      auto drain = sink_scheduler.schedule([&] { drained.set_value(); });
+      drained.get_future().get();
+    }
+
+    std::cout << slots << " slots: " << int(kBodySize / best.count() / (1024 * 1024)) << " MB/s"
+              << std::endl;
+  }
+
+  std::promise<void> stopped;
+  auto stop = main_scheduler.schedule([&] {
+    server.reset();
+    stopped.set_value();
+  });
+  stopped.get_future().get();
+}
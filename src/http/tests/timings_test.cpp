@@ -0,0 +1,119 @@
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "http/http.h"
+#include "http/server/server.h"
+
+// Requests from a local server that takes a known time to answer, with a consumer that is busy
+// when a response comes in, and checks that the time shows up in the right phase.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr auto kServerDelay = 50ms;
+constexpr auto kBusyTime = 100ms;
+constexpr int kRequests = 10;
+
+void print(const char *name, const http::Histogram &histogram) {
+  std::cout << "  " << name << ": x" << histogram.count << ", mean " << histogram.mean().count()
+            << "us, p95 " << histogram.percentile(95).count() << "us, max "
+            << histogram.max.count() << "us" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  auto main_thread = async::Thread::create("main");
+  auto consumer_thread = async::Thread::create("consumer");
+  auto &main_scheduler = main_thread->scheduler();
+  auto &consumer_scheduler = consumer_thread->scheduler();
+
+  std::unique_ptr<http::Server> server;
+  std::promise<void> started;
+  auto _ = main_scheduler.schedule([&] {
+    auto handler = [&](http::Request req, http::RequestOptions opts) {
+      auto delay = req.url.starts_with("/slow") ? kServerDelay : 0ms;
+      return main_scheduler.schedule(
+          [on_response = opts.on_response] { on_response(std::string(1024, 'x')); },
+          {.delay = std::chrono::milliseconds{delay}});
+    };
+    server = http::makeServer(main_scheduler, handler, {.port = 0});
+    started.set_value();
+  });
+  started.get_future().get();
+
+  auto http = http::Http::create();
+  auto host = "127.0.0.1:" + std::to_string(server->port());
+
+  auto fetch = [&](std::string path) {
+    std::promise<void> done;
+    auto request = http->request(
+        {.url = "http://" + host + path},
+        {.post_to = consumer_scheduler, .on_response = [&](http::Response res) {
+           assert(res.status == 200);
+           done.set_value();
+         }});
+    done.get_future().get();
+  };
+
+  for (int i = 0; i < kRequests; ++i) {
+    // Requests are timed by path, without the query.
+    fetch("/slow?i=" + std::to_string(i));
+  }
+
+  // Keep the consumer busy past the time the response is ready.
+  auto busy = consumer_scheduler.schedule([] { std::this_thread::sleep_for(kBusyTime); });
+  fetch("/fast");
+
+  auto stats = http->stats();
+  for (auto &[key, timings] : stats.timings) {
+    std::cout << key << std::endl;
+    print("queued", timings.queued);
+    print("name lookup", timings.name_lookup);
+    print("connect", timings.connect);
+    print("tls handshake", timings.tls_handshake);
+    print("wait", timings.wait);
+    print("receive", timings.receive);
+    print("total", timings.total);
+    print("delivery", timings.delivery);
+  }
+  assert(stats.timings.size() == 2);
+
+  auto &slow = stats.timings[host + "/slow"];
+  assert(slow.total.count == kRequests);
+  assert(slow.delivery.count == kRequests);
+  // One connection is kept open for all of them, and there's no TLS.
+  assert(slow.connect.count == 1);
+  assert(slow.tls_handshake.count == 0);
+  assert(slow.wait.mean() >= kServerDelay && slow.wait.mean() < 2 * kServerDelay);
+  assert(slow.total.mean() >= slow.wait.mean());
+  assert(slow.delivery.max < kServerDelay);
+
+  auto &fast = stats.timings[host + "/fast"];
+  assert(fast.total.count == 1);
+  assert(fast.wait.max < kServerDelay);
+  assert(fast.delivery.max >= kBusyTime / 2);
+
+  // Past a few distinct paths, the rest are timed together rather than one by one.
+  constexpr int kMorePaths = 20;
+  for (int i = 0; i < kMorePaths; ++i) {
+    fetch("/path/" + std::to_string(i));
+  }
+  stats = http->stats();
+  assert(stats.timings.size() == http::Stats::kMaxTimingsKeys);
+  auto &other = stats.timings[http::Stats::kOtherTimingsKey];
+  assert(other.total.count == 2 + kMorePaths - (http::Stats::kMaxTimingsKeys - 1));
+  std::cout << "Timed " << other.total.count << " requests to other paths together" << std::endl;
+
+  std::promise<void> stopped;
+  auto stop = main_scheduler.schedule([&] {
+    server.reset();
+    stopped.set_value();
+  });
+  stopped.get_future().get();
+}
@@ -0,0 +1,137 @@
+#include "bit_planes.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iostream>
+
+namespace ikea {
+namespace {
+
+using namespace std::chrono_literals;
+
+// Sleeping is only accurate to scheduler granularity, so the last stretch is spun.
+constexpr auto kSpinThreshold = 100us;
+
+void setRealtimePriority() {
+#if __APPLE__
+  pthread_setname_np("ikea-output");
+#endif
+  auto param = sched_param{};
+  param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+  if (auto err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) {
+    std::cerr << "Failed to set output thread priority: " << std::strerror(err) << std::endl;
+  }
+}
+
+bool isStatic(const Planes &planes) {
+  return std::all_of(planes.begin() + 1, planes.end(), [&](auto &p) { return p == planes[0]; });
+}
+
+}  // namespace
+
+void pack(const Levels &levels, Planes &planes) {
+  static_assert(std::endian::native == std::endian::little);
+
+  // Branch-free over contiguous bytes so that it vectorizes.
+  alignas(16) Levels quantized;
+  for (size_t i = 0; i < kNumPixels; ++i) {
+    // x / 255 for x < 65535, without the division.
+    uint16_t x = levels[i] * kMaxLevel + kDitherThresholds[i];
+    quantized[i] = (x + 1 + (x >> 8)) >> 8;
+  }
+  // Eight pixels per multiply: they're adjacent in the wire order.
+  for (size_t i = 0; i < Plane().size(); ++i) {
+    uint64_t q;
+    std::memcpy(&q, &quantized[8 * i], sizeof(q));
+    for (size_t p = 0; p < kNumBitPlanes; ++p) {
+      // Gathers bit p of the eight bytes into one byte, first byte in the top bit.
+      planes[p][i] = (((q >> p) & 0x0101010101010101) * 0x8040201008040201) >> 56;
+    }
+  }
+}
+
+BitPlaneOutput::BitPlaneOutput(std::unique_ptr<PanelOutput> output, std::chrono::microseconds lsb)
+    : _output{std::move(output)}, _lsb{lsb}, _thread{[this] { run(); }} {}
+
+BitPlaneOutput::~BitPlaneOutput() {
+  {
+    auto lock = std::unique_lock(_mutex);
+    _stop = true;
+  }
+  _cv.notify_all();
+  _thread.join();
+}
+
+void BitPlaneOutput::update(const Planes &planes) {
+  {
+    auto lock = std::unique_lock(_mutex);
+    _planes = planes;
+    _dirty = true;
+  }
+  _cv.notify_all();
+}
+
+BitPlaneOutput::Stats BitPlaneOutput::stats() const {
+  auto lock = std::unique_lock(_mutex);
+  return _stats;
+}
+
+void BitPlaneOutput::run() {
+  setRealtimePriority();
+
+  auto planes = Planes{};
+  auto stats = Stats{};
+  auto is_static = true;
+
+  auto lock = std::unique_lock(_mutex);
+
+  while (!_stop) {
+    if (_dirty) {
+      planes = _planes;
+      _dirty = false;
+
+      // Without intermediate levels all planes are equal and latching once is enough.
+      if ((is_static = isStatic(planes))) {
+        lock.unlock();
+        _output->write(planes[0]);
+        lock.lock();
+        continue;
+      }
+    }
+    if (is_static) {
+      _cv.wait(lock, [this] { return _stop || _dirty; });
+      continue;
+    }
+    lock.unlock();
+
+    auto deadline = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kNumBitPlanes; ++i) {
+      _output->write(planes[i]);
+      deadline += _lsb * (1 << i);
+      sleepUntil(deadline, stats);
+    }
+    ++stats.frames;
+
+    lock.lock();
+    _stats = stats;
+  }
+}
+
+void BitPlaneOutput::sleepUntil(std::chrono::steady_clock::time_point deadline, Stats &stats) {
+  if (deadline - std::chrono::steady_clock::now() > kSpinThreshold) {
+    std::this_thread::sleep_until(deadline - kSpinThreshold);
+  }
+  auto now = std::chrono::steady_clock::now();
+  while (now < deadline) {
+    now = std::chrono::steady_clock::now();
+  }
+  auto lateness = now - deadline;
+  ++stats.planes;
+  stats.total_lateness += lateness;
+  stats.max_lateness = std::max<std::chrono::nanoseconds>(stats.max_lateness, lateness);
+}
+
+}  // namespace ikea
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace ikea {
+
+constexpr size_t kWidth = 16;
+constexpr size_t kHeight = 16;
+constexpr size_t kNumPixels = kWidth * kHeight;
+constexpr size_t kNumBitPlanes = 4;
+constexpr uint8_t kMaxLevel = (1 << kNumBitPlanes) - 1;
+
+// One bit per pixel in the order the panel shifts them in, most significant bit first.
+using Plane = std::array<uint8_t, kNumPixels / 8>;
+// Plane i holds bit i of every pixel's level.
+using Planes = std::array<Plane, kNumBitPlanes>;
+// 8-bit pixel levels, in the same order as |Plane|.
+using Levels = std::array<uint8_t, kNumPixels>;
+
+// Position of pixel (x, y) in the wire order, indexed by y * kWidth + x. The panel is made of
+// four 16x4 sections, each shifted in as eight 8-pixel runs:
+// 20
+// 31
+// 46
+// 57
+inline constexpr auto kPixelOffsets = [] {
+  std::array<uint8_t, kNumPixels> offsets = {};
+  for (size_t py = 0; py < kHeight; ++py) {
+    for (size_t px = 0; px < kWidth; ++px) {
+      auto sec = py >> 2;
+      auto x = px >> 3;  // 0-1
+      auto y = py & 3;   // 0-4
+      auto lower = y >= 2;
+      auto index = 2 + lower * 2 + (lower * 4 * x - x * 2) + (y % 2);
+      offsets[py * kWidth + px] = 64 * sec + 8 * index + (index % 2 ? px & 7 : (7 - px) & 7);
+    }
+  }
+  return offsets;
+}();
+
+// 4x4 Bayer thresholds in wire order, scaled to a fraction of one output level.
+inline constexpr auto kDitherThresholds = [] {
+  constexpr uint8_t kBayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+  std::array<uint8_t, kNumPixels> thresholds = {};
+  for (size_t y = 0; y < kHeight; ++y) {
+    for (size_t x = 0; x < kWidth; ++x) {
+      thresholds[kPixelOffsets[y * kWidth + x]] = (2 * kBayer[y & 3][x & 3] + 1) * 255 / 32;
+    }
+  }
+  return thresholds;
+}();
+
+// Quantizes |levels| to kNumBitPlanes bits with ordered dithering and packs them into |planes|.
+void pack(const Levels &levels, Planes &planes);
+
+struct PanelOutput {
+  virtual ~PanelOutput() = default;
+  // Shifts |plane| into the panel and latches it.
+  virtual void write(const Plane &) = 0;
+};
+
+// Binary code modulation: plane i is latched and held for (1 << i) * lsb, which gives the 1-bit
+// panel 2^kNumBitPlanes levels. The deadlines are in the microsecond range, so the loop runs on
+// its own high priority thread rather than on a scheduler.
+class BitPlaneOutput final {
+ public:
+  struct Stats {
+    uint64_t frames = 0;
+    uint64_t planes = 0;
+    std::chrono::nanoseconds max_lateness = {};
+    std::chrono::nanoseconds total_lateness = {};
+  };
+
+  BitPlaneOutput(std::unique_ptr<PanelOutput>, std::chrono::microseconds lsb);
+  ~BitPlaneOutput();
+
+  void update(const Planes &);
+  Stats stats() const;
+
+ private:
+  void run();
+  void sleepUntil(std::chrono::steady_clock::time_point deadline, Stats &);
+
+  std::unique_ptr<PanelOutput> _output;
+  std::chrono::microseconds _lsb;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  Planes _planes = {};
+  bool _dirty = false;
+  bool _stop = false;
+  Stats _stats;
+
+  std::thread _thread;
+};
+
+}  // namespace ikea
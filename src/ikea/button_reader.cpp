@@ -1,5 +1,6 @@
 #include "button_reader.h"
 
+#include <iostream>
 #include <utility>
 
 #if !WITH_SIMULATOR
@@ -9,18 +10,26 @@
 #endif
 
 namespace ikea {
+namespace {
 
-void s_onPress(int pi, unsigned user_gpio, unsigned level, uint32_t tick, void *reader) {
-  static_cast<ButtonReader *>(reader)->onPress();
+constexpr unsigned kButtonGpio = 21;
+
+}  // namespace
+
+void s_onEdge(int pi, unsigned user_gpio, unsigned level, uint32_t tick, void *reader) {
+  static_cast<ButtonReader *>(reader)->onEdge(level, tick);
 }
 
-ButtonReader::ButtonReader(async::Scheduler &main_scheduler, OnPress on_press)
-    : _main_scheduler{main_scheduler}, _on_press{std::move(on_press)} {
+ButtonReader::ButtonReader(async::Scheduler &main_scheduler, OnPress on_press, bool verbose)
+    : _main_scheduler{main_scheduler},
+      _on_press{std::move(on_press)},
+      _verbose{verbose},
+      _decoder{[this](auto gesture, auto tick) { onGesture(gesture, tick); }} {
 #if !WITH_SIMULATOR
   _gpio = pigpio_start(nullptr, nullptr);
-  set_mode(_gpio, 21, PI_INPUT);
-  set_pull_up_down(_gpio, 21, PI_PUD_UP);
-  _callback = callback_ex(_gpio, 21, FALLING_EDGE, s_onPress, this);
+  set_mode(_gpio, kButtonGpio, PI_INPUT);
+  set_pull_up_down(_gpio, kButtonGpio, PI_PUD_UP);
+  _callback = callback_ex(_gpio, kButtonGpio, EITHER_EDGE, s_onEdge, this);
 #endif
 }
 
@@ -31,8 +40,64 @@ ButtonReader::~ButtonReader() {
 #endif
 }
 
-void ButtonReader::onPress() {
-  _work = _main_scheduler.schedule([this] { _on_press(); });
+void ButtonReader::onEdge(unsigned level, uint32_t tick) {
+#if !WITH_SIMULATOR
+  if (level == PI_TIMEOUT) {
+    _decoder.onTimeout(tick);
+  } else {
+    // The button pulls the input low.
+    _decoder.onEdge(level == 0, tick);
+  }
+  // The watchdog reports back once no edge came for that long, so that neither a bouncing
+  // release nor a long press has to wait for the next edge.
+  set_watchdog(_gpio, kButtonGpio, _decoder.timeoutUs() / 1000);
+#else
+  _decoder.onEdge(level == 0, tick);
+#endif
+}
+
+void ButtonReader::onGesture(Gesture gesture, uint32_t tick) {
+  auto at = std::chrono::steady_clock::now();
+#if !WITH_SIMULATOR
+  // Move the timestamp back to when the edge happened, to include pigpio's delivery delay.
+  at -= std::chrono::microseconds{get_current_tick(_gpio) - tick};
+#endif
+  if (!_events.push({.gesture = gesture, .at = at})) {
+    std::cerr << "button: dropped " << toString(gesture) << std::endl;
+    return;
+  }
+  if (_wakeup_pending.exchange(true)) {
+    return;
+  }
+  // The reader belongs to the main thread, so the wakeup can't be kept in it from here. It keeps
+  // itself until it has run instead.
+  auto wakeup = std::make_shared<async::Lifetime>();
+  *wakeup = _main_scheduler.schedule([this, wakeup, alive = std::weak_ptr(_alive)] {
+    if (alive.lock()) {
+      dispatch();
+    }
+  });
+}
+
+void ButtonReader::dispatch() {
+  // Gestures pushed from here on wake the main thread again.
+  _wakeup_pending = false;
+  while (auto event = _events.pop()) {
+    _on_press(event->gesture);
+
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - event->at);
+    ++_num_events;
+    _total_latency += latency;
+    _max_latency = std::max(_max_latency, latency);
+
+    if (!_verbose) {
+      continue;
+    }
+    std::cout << "button: " << toString(event->gesture) << ", latency " << latency.count()
+              << "us (avg " << _total_latency.count() / _num_events << "us, max "
+              << _max_latency.count() << "us)" << std::endl;
+  }
 }
 
 }  // namespace ikea
@@ -1,27 +1,53 @@
 #pragma once
 
 #include <async/scheduler.h>
+#include <async/spsc_queue.h>
+#include <ikea/gesture_decoder.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <memory>
 
 namespace ikea {
 
 struct ButtonReader {
-  using OnPress = std::function<void()>;
+  using OnPress = std::function<void(Gesture)>;
 
-  ButtonReader(async::Scheduler &main_scheduler, OnPress);
+  // With |verbose|, logs each press with the time it took to handle.
+  ButtonReader(async::Scheduler &main_scheduler, OnPress, bool verbose = false);
   ~ButtonReader();
 
  private:
-  friend void s_onPress(int pi, unsigned user_gpio, unsigned level, uint32_t tick, void *reader);
+  friend void s_onEdge(int pi, unsigned user_gpio, unsigned level, uint32_t tick, void *reader);
 
-  void onPress();
+  struct Event {
+    Gesture gesture;
+    std::chrono::steady_clock::time_point at;
+  };
+
+  // pigpio callback thread
+  void onEdge(unsigned level, uint32_t tick);
+  void onGesture(Gesture, uint32_t tick);
+
+  // main thread
+  void dispatch();
 
   async::Scheduler &_main_scheduler;
   OnPress _on_press;
+  bool _verbose;
+  GestureDecoder _decoder;
+  async::SpscQueue<Event, 16> _events;
   int _gpio = -1;
   int _callback = -1;
-  async::Lifetime _work;
+  // Only the main thread holds this, wakeups find it gone once the reader is.
+  std::shared_ptr<bool> _alive = std::make_shared<bool>();
+  std::atomic_bool _wakeup_pending = false;
+
+  uint64_t _num_events = 0;
+  std::chrono::microseconds _total_latency = {};
+  std::chrono::microseconds _max_latency = {};
 };
 
 }  // namespace ikea
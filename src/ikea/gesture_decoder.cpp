@@ -0,0 +1,86 @@
+#include "gesture_decoder.h"
+
+#include <utility>
+
+namespace ikea {
+namespace {
+
+constexpr uint32_t kDebounceUs = 20'000;
+constexpr uint32_t kLongPressUs = 600'000;
+constexpr uint32_t kDoublePressGapUs = 300'000;
+
+}  // namespace
+
+const char *toString(Gesture gesture) {
+  switch (gesture) {
+    case Gesture::kShortPress:
+      return "short press";
+    case Gesture::kLongPress:
+      return "long press";
+    case Gesture::kDoublePress:
+      return "double press";
+  }
+  return "";
+}
+
+GestureDecoder::GestureDecoder(OnGesture on_gesture) : _on_gesture{std::move(on_gesture)} {}
+
+void GestureDecoder::onEdge(bool pressed, uint32_t tick) {
+  settle(tick);
+  _level = pressed;
+  _level_at = tick;
+  // Edges within kDebounceUs of the last accepted one are taken as bounces, but the level they
+  // leave behind still counts once it has held.
+  if (pressed != _pressed && tick - _changed_at >= kDebounceUs) {
+    setPressed(pressed, tick);
+  }
+}
+
+void GestureDecoder::onTimeout(uint32_t tick) {
+  settle(tick);
+  if (_pressed && !_long_reported && tick - _pressed_at >= kLongPressUs) {
+    _long_reported = true;
+    _has_short = false;
+    _on_gesture(Gesture::kLongPress, tick);
+  }
+}
+
+uint32_t GestureDecoder::timeoutUs() const {
+  if (_level != _pressed) {
+    return kDebounceUs;
+  }
+  return _pressed && !_long_reported ? kLongPressUs : 0;
+}
+
+void GestureDecoder::settle(uint32_t tick) {
+  if (_level != _pressed && tick - _level_at >= kDebounceUs) {
+    setPressed(_level, _level_at);
+  }
+}
+
+void GestureDecoder::setPressed(bool pressed, uint32_t tick) {
+  _pressed = pressed;
+  _changed_at = tick;
+
+  if (pressed) {
+    _pressed_at = tick;
+    _long_reported = false;
+    return;
+  }
+  if (_long_reported) {
+    return;
+  }
+  if (tick - _pressed_at >= kLongPressUs) {
+    _has_short = false;
+    return _on_gesture(Gesture::kLongPress, tick);
+  }
+  if (_has_short && _pressed_at - _short_released_at <= kDoublePressGapUs) {
+    _has_short = false;
+    return _on_gesture(Gesture::kDoublePress, tick);
+  }
+  _has_short = true;
+  _short_released_at = tick;
+  _on_gesture(Gesture::kShortPress, tick);
+}
+
+}  // namespace ikea
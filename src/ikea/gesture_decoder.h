@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+namespace ikea {
+
+enum class Gesture {
+  kShortPress,
+  kLongPress,
+  // Reported in addition to the short press before it, which is never delayed.
+  kDoublePress,
+};
+
+const char *toString(Gesture);
+
+// Turns raw edges into gestures. Ticks are pigpio's microsecond timestamps of the edges, which
+// wrap around every ~72 minutes.
+class GestureDecoder final {
+ public:
+  using OnGesture = std::function<void(Gesture, uint32_t tick)>;
+
+  explicit GestureDecoder(OnGesture);
+
+  void onEdge(bool pressed, uint32_t tick);
+  // Called when no edge came for timeoutUs(), so that a level left behind by bounces settles and
+  // long presses fire without waiting for the next edge.
+  void onTimeout(uint32_t tick);
+  // How long after the last edge or timeout onTimeout() is wanted, or 0 if it isn't.
+  uint32_t timeoutUs() const;
+
+ private:
+  void settle(uint32_t tick);
+  void setPressed(bool pressed, uint32_t tick);
+
+  OnGesture _on_gesture;
+  // The debounced level, and when it last changed.
+  bool _pressed = false;
+  uint32_t _changed_at = 0;
+  // The raw level, and the tick of the edge that set it.
+  bool _level = false;
+  uint32_t _level_at = 0;
+  bool _long_reported = false;
+  bool _has_short = false;
+  uint32_t _pressed_at = 0;
+  uint32_t _short_released_at = 0;
+};
+
+}  // namespace ikea
@@ -1,8 +1,10 @@
 #include <async/scheduler.h>
 #include <color/color.h>
+#include <ikea/bit_planes.h>
 #include <ikea/ikea.h>
 #include <render/renderer_impl.h>
 
+#include <algorithm>
 #include <iostream>
 
 #if !WITH_SIMULATOR
@@ -16,14 +18,33 @@ namespace ikea {
 namespace {
 
 using namespace render;
+using namespace std::chrono_literals;
 
-constexpr size_t kWidth = 16;
-constexpr size_t kHeight = 16;
+// Shifting a plane at 2 MHz takes 128us, which has to fit in the shortest plane.
+constexpr auto kLsbDuration = 200us;
+
+#if !WITH_SIMULATOR
+
+struct SpiPanel final : PanelOutput {
+  SpiPanel(SPI &spi, int gpio) : _spi{spi}, _gpio{gpio} {}
+
+  void write(const Plane &plane) final {
+    auto data = plane;
+    gpio_write(_gpio, 25, 0);
+    _spi.write(data.data(), data.size());
+    gpio_write(_gpio, 25, 1);
+  }
+
+ private:
+  SPI &_spi;
+  int _gpio;
+};
+
+#endif
 
 struct IkeaLED final : BufferedLED {
   IkeaLED() {
-    static_assert((kWidth * kHeight) % 4 == 0);
-    _data.resize(kWidth * kHeight / 8);
+    static_assert(kNumPixels % 8 == 0);
 
 #if !WITH_SIMULATOR
     _config = spi_config_t{
@@ -50,12 +71,16 @@ struct IkeaLED final : BufferedLED {
 
     set_mode(_gpio, 8, PI_OUTPUT);
     set_mode(_gpio, 25, PI_OUTPUT);
+
+    _output = std::make_unique<BitPlaneOutput>(std::make_unique<SpiPanel>(*_spi, _gpio),
+                                               kLsbDuration);
 #else
     _pipe = decltype(_pipe){"./simulator_out2"};
 #endif
   }
   ~IkeaLED() {
 #if !WITH_SIMULATOR
+    _output.reset();
     if (_spi) {
       pigpio_stop(_gpio);
     }
@@ -63,65 +88,54 @@ struct IkeaLED final : BufferedLED {
   }
 
  private:
-  void clear() final { std::fill(begin(_data), end(_data), 0); }
+  void clear() final { std::fill(begin(_levels), end(_levels), 0); }
   void show() final {
 #if !WITH_SIMULATOR
     set_PWM_dutycycle(_gpio, 8, 255 - timeOfDayBrightness(_settings.brightness));
 #endif
 
+    auto planes = Planes{};
+    pack(_levels, planes);
+
 #if !WITH_SIMULATOR
-    if (_spi) {
-      gpio_write(_gpio, 25, 0);
-      _spi->write(_data.data(), _data.size());
-      gpio_write(_gpio, 25, 1);
+    if (_output) {
+      _output->update(planes);
     }
 #else
     _pipe << "\n\n\n\n\n\n";
 
-    for (auto y = 0; y < 16; ++y) {
-      for (auto x = 0; x < 16; ++x) {
-        auto i = offset({x, y});
-        auto val = _data[i >> 3] & bitMask(i);
-        _pipe << (val ? "⚪️" : "⚫️") << " ";
+    for (size_t y = 0; y < kHeight; ++y) {
+      for (size_t x = 0; x < kWidth; ++x) {
+        auto i = kPixelOffsets[y * kWidth + x];
+        auto level = 0;
+        for (size_t p = 0; p < kNumBitPlanes; ++p) {
+          level |= bool(planes[p][i >> 3] & (1 << (7 - (i & 7)))) << p;
+        }
+        auto v = std::to_string(level * 255 / kMaxLevel);
+        _pipe << "\033[38;2;" << v << ";" << v << ";" << v << "m\u2588\u2588\033[0m";
       }
       _pipe << std::endl;
     }
 #endif
   }
 
+  Coord size() const final { return {kWidth, kHeight}; }
+
   void setLogo(Color color, const Options &options) final {}
   void set(Coord pos, Color color, const Options &options) final {
-    if (pos.x >= 0 && pos.x < 16 && pos.y >= 0 && pos.y < 16) {
-      auto [r, g, b] = color;
-      auto i = offset(pos);
-      if (r || g || b) {
-        _data[i >> 3] |= bitMask(i);
-      } else {
-        _data[i >> 3] &= ~bitMask(i);
-      }
+    if (pos.x >= 0 && pos.x < int(kWidth) && pos.y >= 0 && pos.y < int(kHeight)) {
+      auto [r, g, b] = color * options.src;
+      _levels[kPixelOffsets[pos.y * kWidth + pos.x]] = std::max({r, g, b});
     }
   }
 
-  // 20
-  // 31
-  // 46
-  // 57
-  size_t offset(Coord pos) {
-    auto sec = pos.y >> 2;
-    auto x = pos.x >> 3;  // 0-1
-    auto y = pos.y & 3;   // 0-4
-    auto lower = y >= 2;
-    auto index = 2 + lower * 2 + (lower * 4 * x - x * 2) + (y % 2);
-    return 64 * sec + 8 * index + (index % 2 ? pos.x & 7 : 7 - pos.x & 7);
-  }
-  uint8_t bitMask(size_t i) { return 1 << (7 - (i & 7)); }
-
-  std::vector<uint8_t> _data;
+  Levels _levels = {};
 
 #if !WITH_SIMULATOR
   spi_config_t _config;
   std::unique_ptr<SPI> _spi;
   int _gpio = -1;
+  std::unique_ptr<BitPlaneOutput> _output;
 #else
   std::ofstream _pipe;
 #endif
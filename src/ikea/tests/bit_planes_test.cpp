@@ -0,0 +1,145 @@
+#include "ikea/bit_planes.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Stand-in for the SPI + latch GPIO: records when each plane is latched and spends the time a
+// 2 MHz transfer would take.
+struct FakePanel final : ikea::PanelOutput {
+  struct Write {
+    std::chrono::steady_clock::time_point at;
+    ikea::Plane plane;
+  };
+
+  FakePanel(std::mutex &mutex, std::vector<Write> &writes) : _mutex{mutex}, _writes{writes} {}
+
+  void write(const ikea::Plane &plane) final {
+    auto end = std::chrono::steady_clock::now() + 128us;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+    auto lock = std::unique_lock(_mutex);
+    _writes.push_back({std::chrono::steady_clock::now(), plane});
+  }
+
+ private:
+  std::mutex &_mutex;
+  std::vector<Write> &_writes;
+};
+
+ikea::Planes planesWithLevel(uint8_t level) {
+  auto planes = ikea::Planes{};
+  for (size_t p = 0; p < ikea::kNumBitPlanes; ++p) {
+    planes[p].fill(level & (1 << p) ? 0xff : 0);
+  }
+  return planes;
+}
+
+int main(int argc, char *argv[]) {
+  {
+    auto offsets = ikea::kPixelOffsets;
+    std::sort(offsets.begin(), offsets.end());
+    for (size_t i = 0; i < offsets.size(); ++i) {
+      assert(offsets[i] == i);
+    }
+  }
+  {
+    auto levels = ikea::Levels{};
+    auto engine = std::minstd_rand{};
+    std::generate(levels.begin(), levels.end(), [&] { return engine() & 0xff; });
+
+    auto planes = ikea::Planes{};
+    ikea::pack(levels, planes);
+
+    for (size_t i = 0; i < ikea::kNumPixels; ++i) {
+      auto level = 0;
+      for (size_t p = 0; p < ikea::kNumBitPlanes; ++p) {
+        level |= bool(planes[p][i >> 3] & (1 << (7 - (i & 7)))) << p;
+      }
+      auto exact = levels[i] * ikea::kMaxLevel / 255.0;
+      assert(level == std::floor(exact) || level == std::ceil(exact));
+    }
+
+    // Flat mid-gray has to average out to the same level.
+    levels.fill(0x80);
+    ikea::pack(levels, planes);
+    auto sum = 0;
+    for (size_t i = 0; i < ikea::kNumPixels; ++i) {
+      for (size_t p = 0; p < ikea::kNumBitPlanes; ++p) {
+        sum += bool(planes[p][i >> 3] & (1 << (7 - (i & 7)))) << p;
+      }
+    }
+    auto mean = double(sum) / ikea::kNumPixels;
+    assert(std::abs(mean - 0x80 * ikea::kMaxLevel / 255.0) < 0.25);
+
+    constexpr auto kIterations = 100000;
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < kIterations; ++i) {
+      levels[i & 0xff] = i;
+      ikea::pack(levels, planes);
+      asm volatile("" : : "r"(planes.data()) : "memory");
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "pack: "
+              << std::chrono::duration<double, std::nano>(elapsed).count() / kIterations
+              << "ns/frame" << std::endl;
+  }
+  {
+    std::mutex mutex;
+    std::vector<FakePanel::Write> writes;
+    {
+      auto output = ikea::BitPlaneOutput(std::make_unique<FakePanel>(mutex, writes), 200us);
+      output.update(planesWithLevel(ikea::kMaxLevel));
+      std::this_thread::sleep_for(50ms);
+    }
+    std::cout << "static frame: " << writes.size() << " write(s)" << std::endl;
+    assert(writes.size() == 1);
+  }
+  {
+    constexpr auto kLsb = std::chrono::microseconds{200};
+    constexpr auto kDuration = 1s;
+
+    std::mutex mutex;
+    std::vector<FakePanel::Write> writes;
+    writes.reserve(kDuration / kLsb);
+    ikea::BitPlaneOutput::Stats stats;
+    {
+      auto output = ikea::BitPlaneOutput(std::make_unique<FakePanel>(mutex, writes), kLsb);
+      output.update(planesWithLevel(0b0101));
+      std::this_thread::sleep_for(kDuration);
+      stats = output.stats();
+    }
+    assert(stats.frames > 0);
+
+    auto lock = std::unique_lock(mutex);
+    auto max_error = std::chrono::nanoseconds{};
+    auto total_error = std::chrono::nanoseconds{};
+    for (size_t i = 1; i < writes.size(); ++i) {
+      auto plane = (i - 1) % ikea::kNumBitPlanes;
+      assert(writes[i - 1].plane == planesWithLevel(0b0101)[plane]);
+      auto error = writes[i].at - writes[i - 1].at - kLsb * (1 << plane);
+      error = error.count() < 0 ? -error : error;
+      max_error = std::max(max_error, error);
+      total_error += error;
+    }
+    auto num_intervals = writes.size() - 1;
+    auto us = [](auto d) { return std::chrono::duration<double, std::micro>(d).count(); };
+
+    std::cout << "frames: " << stats.frames << " ("
+              << stats.frames / std::chrono::duration<double>(kDuration).count() << " Hz)"
+              << std::endl;
+    std::cout << "plane time error: mean " << us(total_error / num_intervals) << "us, max "
+              << us(max_error) << "us" << std::endl;
+    std::cout << "deadline lateness: mean " << us(stats.total_lateness / stats.planes)
+              << "us, max " << us(stats.max_lateness) << "us" << std::endl;
+  }
+  std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,79 @@
+#include "ikea/gesture_decoder.h"
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+using ikea::Gesture;
+
+int main(int argc, char *argv[]) {
+  std::vector<Gesture> gestures;
+  auto decoder = ikea::GestureDecoder([&](auto gesture, auto) { gestures.push_back(gesture); });
+
+  uint32_t t = 1'000'000;
+  auto press = [&](uint32_t at) { decoder.onEdge(true, t += at); };
+  auto release = [&](uint32_t at) { decoder.onEdge(false, t += at); };
+
+  // Bouncing contacts make a single short press.
+  press(0);
+  release(2'000);
+  press(1'000);
+  release(150'000);
+  press(3'000);
+  release(1'000);
+  assert(gestures == std::vector{Gesture::kShortPress});
+  assert(decoder.timeoutUs() == 0);
+
+  // Pressing again within the gap after that short press makes a double press.
+  gestures.clear();
+  press(250'000);
+  release(100'000);
+  assert(gestures == std::vector{Gesture::kDoublePress});
+
+  // Long press fires while held, and not again on release.
+  gestures.clear();
+  press(1'000'000);
+  assert(decoder.timeoutUs() == 600'000);
+  decoder.onTimeout(t + 300'000);
+  assert(gestures.empty());
+  decoder.onTimeout(t + 600'000);
+  assert(gestures == std::vector{Gesture::kLongPress});
+  release(700'000);
+  assert(gestures == std::vector{Gesture::kLongPress});
+
+  // Long press is still detected on release if the watchdog never reported.
+  gestures.clear();
+  press(1'000'000);
+  release(800'000);
+  assert(gestures == std::vector{Gesture::kLongPress});
+
+  // A release that comes while the press is still taken to be bouncing isn't lost, it counts
+  // once it has held.
+  gestures.clear();
+  press(1'000'000);
+  release(10'000);
+  assert(gestures.empty());
+  assert(decoder.timeoutUs() == 20'000);
+  decoder.onTimeout(t + 20'000);
+  assert(gestures == std::vector{Gesture::kShortPress});
+
+  // Neither is a press right after the bounces of a release.
+  gestures.clear();
+  press(1'000'000);
+  release(100'000);
+  press(2'000);
+  release(1'000);
+  press(7'000);
+  decoder.onTimeout(t + 20'000);
+  release(100'000);
+  assert((gestures == std::vector{Gesture::kShortPress, Gesture::kDoublePress}));
+
+  // Ticks wrap around.
+  gestures.clear();
+  t = uint32_t(-50'000);
+  press(1'000'000);
+  release(100'000);
+  assert(gestures == std::vector{Gesture::kShortPress});
+
+  std::cout << "OK" << std::endl;
+}
@@ -1,6 +1,17 @@
 #include "program_options.h"
 
+#include <charconv>
+
 namespace program_options {
+namespace {
+
+int parseInt(std::string_view str, int fallback) {
+  auto value = fallback;
+  std::from_chars(str.data(), str.data() + str.size(), value);
+  return value;
+}
+
+}  // namespace
 
 Options parseOptions(int argc, char *argv[]) {
   Options opts;
@@ -10,6 +21,20 @@ Options parseOptions(int argc, char *argv[]) {
       opts.verbose = true;
     } else if (arg.find("--base-url") == 0) {
       opts.base_url = arg.substr(11);
+    } else if (arg.find("--push") == 0) {
+      opts.push = true;
+    } else if (arg.find("--address") == 0) {
+      opts.address = arg.substr(10);
+    } else if (arg.find("--port") == 0) {
+      opts.port = parseInt(arg.substr(7), opts.port);
+    } else if (arg.find("--io-threads") == 0) {
+      opts.io_threads = parseInt(arg.substr(13), opts.io_threads);
+    } else if (arg.find("--reuse-port") == 0) {
+      opts.reuse_port = true;
+    } else if (arg.find("--unix-socket") == 0) {
+      opts.unix_socket = arg.substr(14);
+    } else if (arg.find("--ddp-port") == 0) {
+      opts.ddp_port = parseInt(arg.substr(11), opts.ddp_port);
     }
   }
   return opts;
@@ -7,6 +7,14 @@ namespace program_options {
 struct Options {
   bool verbose = false;
   std::string base_url;
+  bool push = false;
+  std::string address = "0.0.0.0";
+  int port = 8080;
+  int io_threads = 1;
+  bool reuse_port = false;
+  std::string unix_socket;
+  // UDP port to take frames over DDP on, 4048 by convention. 0 doesn't listen.
+  int ddp_port = 0;
 };
 
 Options parseOptions(int argc, char *argv[]);
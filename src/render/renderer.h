@@ -5,6 +5,7 @@
 
 #include <chrono>
 #include <functional>
+#include <vector>
 
 namespace render {
 
@@ -31,13 +32,34 @@ struct LED {
   virtual void set(Coord, Color, const Options & = {}) = 0;
 };
 
+// What was shown on the panel, pixels row by row from the top left.
+struct Frame {
+  Coord size;
+  Color logo;
+  std::vector<Color> pixels;
+};
+
 struct Renderer {
   using RenderCallback =
       std::function<std::chrono::milliseconds(LED &, std::chrono::milliseconds elapsed)>;
+  using FrameObserver = std::function<void(const Frame &)>;
+  using ShownCallback = std::function<void()>;
 
   virtual ~Renderer() = default;
   virtual void add(RenderCallback) = 0;
   virtual void notify() = 0;
+  // Of the panel, in pixels.
+  virtual Coord size() const = 0;
+  // Renders with |callback| alone, in place of those that were added, until it returns 0 without
+  // drawing. Those carry on afterwards. |on_shown| is called right after each frame that
+  // |callback| drew is on the panel. Replaces any previous takeover.
+  virtual void takeOver(RenderCallback callback, ShownCallback on_shown) = 0;
+  // Calls |on_shown| once, right after the next frame is on the panel, without asking for one.
+  // Called from a render callback, that's the frame it is drawing.
+  virtual void afterNextShow(ShownCallback on_shown) = 0;
+  // Passes a copy of each frame to |observer| as it is shown. Frames are only recorded while an
+  // observer is set.
+  virtual void setFrameObserver(FrameObserver observer) = 0;
 };
 
 }  // namespace render
@@ -1,10 +1,40 @@
 #include <render/renderer_impl.h>
 
+#include <algorithm>
 #include <queue>
+#include <utility>
 
 namespace render {
 namespace {
 
+// Draws to the panel, and into a frame that can be passed on. The blend is a plain sum, close
+// enough to that of the panel for a preview.
+struct RecordingLED final : LED {
+  RecordingLED(LED &led, Frame &frame) : _led{led}, _frame{frame} {}
+
+  void setLogo(Color color, const Options &options) final {
+    _led.setLogo(color, options);
+    blend(_frame.logo, color, options);
+  }
+  void set(Coord pos, Color color, const Options &options) final {
+    _led.set(pos, color, options);
+    auto [width, height] = _frame.size;
+    if (pos.x >= 0 && pos.x < width && pos.y >= 0 && pos.y < height) {
+      blend(_frame.pixels[pos.y * width + pos.x], color, options);
+    }
+  }
+
+ private:
+  static void blend(Color &dst, Color src, const Options &options) {
+    for (size_t i = 0; i < dst.size(); ++i) {
+      dst[i] = std::min(255.0, options.dst * dst[i] + options.src * src[i]);
+    }
+  }
+
+  LED &_led;
+  Frame &_frame;
+};
+
 struct RendererImpl final : public Renderer {
   RendererImpl(async::Scheduler &main_scheduler, std::unique_ptr<BufferedLED> led)
       : _main_scheduler{main_scheduler}, _led{std::move(led)} {}
@@ -22,6 +52,25 @@ struct RendererImpl final : public Renderer {
     _render = _main_scheduler.schedule([this] { renderFrame(); });
   }
 
+  Coord size() const final { return _led->size(); }
+
+  void takeOver(RenderCallback callback, ShownCallback on_shown) final {
+    _takeover = std::move(callback);
+    _takeover_shown = std::move(on_shown);
+    _takeover_start = std::chrono::system_clock::now();
+    notify();
+  }
+
+  void afterNextShow(ShownCallback on_shown) final {
+    _after_show.push_back(std::move(on_shown));
+  }
+
+  void setFrameObserver(FrameObserver observer) final {
+    _frame_observer = std::move(observer);
+    auto size = _led->size();
+    _frame = {.size = size, .pixels = std::vector<Color>(size.x * size.y)};
+  }
+
  private:
   void renderFrame() {
     using namespace std::chrono_literals;
@@ -34,12 +83,20 @@ struct RendererImpl final : public Renderer {
 
     auto delay = std::chrono::milliseconds(1min);
 
+    auto recorder = RecordingLED(*_led, _frame);
+    auto &led = _frame_observer ? static_cast<LED &>(recorder) : *_led;
+    if (_frame_observer) {
+      _frame.logo = {};
+      std::fill(_frame.pixels.begin(), _frame.pixels.end(), Color());
+    }
+
     _led->clear();
-    for (auto it = _callbacks.begin(); it != _callbacks.end();) {
+    auto taken_over = renderTakeover(led, now, delay);
+    for (auto it = _callbacks.begin(); !taken_over && it != _callbacks.end();) {
       auto &callback = it->first;
       auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - it->second);
 
-      if (auto next_frame = callback(*_led, elapsed); next_frame.count()) {
+      if (auto next_frame = callback(led, elapsed); next_frame.count()) {
         delay = std::min(next_frame, delay);
         ++it;
       } else {
@@ -47,17 +104,49 @@ struct RendererImpl final : public Renderer {
       }
     }
     _led->show();
+    if (taken_over && _takeover_shown) {
+      _takeover_shown();
+    }
+    for (auto &on_shown : std::exchange(_after_show, {})) {
+      on_shown();
+    }
+    if (_frame_observer) {
+      _frame_observer(_frame);
+    }
 
-    if (!_callbacks.empty()) {
+    if (!_callbacks.empty() || _takeover) {
       _render = _main_scheduler.schedule([this] { renderFrame(); }, {.delay = delay});
     }
   }
 
+  // Returns false once there's no takeover, or it has just ended.
+  bool renderTakeover(LED &led,
+                      std::chrono::system_clock::time_point now,
+                      std::chrono::milliseconds &delay) {
+    if (!_takeover) {
+      return false;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _takeover_start);
+    if (auto next_frame = _takeover(led, elapsed); next_frame.count()) {
+      delay = std::min(next_frame, delay);
+      return true;
+    }
+    _takeover = nullptr;
+    _takeover_shown = nullptr;
+    return false;
+  }
+
   async::Scheduler &_main_scheduler;
   std::unique_ptr<BufferedLED> _led;
   std::vector<std::pair<RenderCallback, std::chrono::system_clock::time_point>> _callbacks;
   std::queue<RenderCallback> _pending_callbacks;
   async::Lifetime _render;
+  RenderCallback _takeover;
+  ShownCallback _takeover_shown;
+  std::vector<ShownCallback> _after_show;
+  std::chrono::system_clock::time_point _takeover_start;
+  FrameObserver _frame_observer;
+  Frame _frame;
 };
 
 }  // namespace
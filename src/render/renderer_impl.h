@@ -8,6 +8,7 @@ namespace render {
 struct BufferedLED : LED {
   virtual void clear() = 0;
   virtual void show() = 0;
+  virtual Coord size() const = 0;
 };
 
 std::unique_ptr<Renderer> createRenderer(async::Scheduler &main_scheduler,
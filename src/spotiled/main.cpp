@@ -7,6 +7,7 @@
 #include <future>
 #include <iostream>
 
+#include "ddp/receiver.h"
 #include "http/http.h"
 #include "http/server/server.h"
 #include "spotiled/spotiled.h"
@@ -14,6 +15,8 @@
 
 struct Stack {
   std::unique_ptr<web_proxy::WebProxy> web_proxy;
+  // Hands the renderer back before it goes.
+  std::unique_ptr<ddp::Receiver> ddp_receiver;
   std::unique_ptr<http::Server> server;
   std::unique_ptr<csignal::SignalCatcher> signal;
 };
@@ -34,8 +37,21 @@ int main(int argc, char *argv[]) {
   auto _ = main_scheduler.schedule([&] {
     stack->web_proxy = std::make_unique<web_proxy::WebProxy>(
         main_scheduler, *http, spotiled::create(main_scheduler), opts.base_url, "spotiled");
+    if (opts.push) {
+      stack->web_proxy->enablePush();
+    }
+    if (opts.ddp_port) {
+      stack->ddp_receiver = std::make_unique<ddp::Receiver>(
+          main_scheduler, stack->web_proxy->renderer(), opts.ddp_port);
+    }
 
-    stack->server = http::makeServer(main_scheduler, stack->web_proxy->asRequestHandler());
+    stack->server = http::makeServer(main_scheduler, stack->web_proxy->asRequestHandler(),
+                                     {.address = opts.address,
+                                      .port = opts.port,
+                                      .io_threads = opts.io_threads,
+                                      .reuse_port = opts.reuse_port,
+                                      .unix_socket = opts.unix_socket,
+                                      .fast_handler = stack->web_proxy->asFastHandler()});
     std::cout << "Listening on port: " << stack->server->port() << std::endl;
 
     stack->signal = std::make_unique<csignal::SignalCatcher>(
@@ -16,6 +16,7 @@ struct SpotiLED final : BufferedLED {
  private:
   void clear() final { _buffer->clear(); }
   void show() final { _led->show(*_buffer); }
+  Coord size() const final { return {23, 16}; }
 
   void setLogo(Color color, const Options &options) final {
     auto [r, g, b] = color;
@@ -0,0 +1,230 @@
+#include "event_hub.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "encoding/base64.h"
+
+extern "C" {
+#include <jq.h>
+}
+
+namespace web_proxy {
+namespace {
+
+constexpr auto kHeartbeat = std::string_view(": heartbeat\n\n");
+// A run of changed bytes ends once this many in a row are unchanged, as a new run costs as much.
+constexpr size_t kMaxRunGap = 3;
+
+static_assert(sizeof(Color) == 3);
+
+// Holds on to a frame until it has been written, counting it as in flight until then.
+struct FrameInFlight {
+  FrameInFlight(std::shared_ptr<std::string> event, std::shared_ptr<std::atomic<int>> count)
+      : event{std::move(event)}, count{std::move(count)} {
+    ++*this->count;
+  }
+  ~FrameInFlight() { --*count; }
+
+  std::shared_ptr<std::string> event;
+  std::shared_ptr<std::atomic<int>> count;
+};
+
+std::shared_ptr<std::string> makeEvent(std::string_view name, std::string_view data) {
+  auto event = std::make_shared<std::string>();
+  event->reserve(name.size() + data.size() + 16);
+  *event += "event: ";
+  *event += name;
+  *event += "\ndata: ";
+  *event += data;
+  *event += "\n\n";
+  return event;
+}
+
+std::string toJson(const StateDiff &states) {
+  auto jv = jv_object();
+  for (auto &[id, data] : states) {
+    jv = jv_object_set(jv, jv_string(id.c_str()), data ? jv_string(data->c_str()) : jv_null());
+  }
+  jv = jv_dump_string(jv, 0);
+  auto json = std::string(jv_string_value(jv));
+  jv_free(jv);
+  return json;
+}
+
+void serialize(const render::Frame &frame, std::string &bytes) {
+  bytes.clear();
+  bytes.reserve(2 + sizeof(Color) * (1 + frame.pixels.size()));
+  bytes += char(frame.size.x);
+  bytes += char(frame.size.y);
+  bytes.append(reinterpret_cast<const char *>(frame.logo.data()), sizeof(Color));
+  bytes.append(reinterpret_cast<const char *>(frame.pixels.data()),
+               sizeof(Color) * frame.pixels.size());
+}
+
+// The runs of bytes that differ between two frames of the same size.
+std::string delta(std::string_view previous, std::string_view frame) {
+  auto runs = std::string();
+  size_t end = 0;
+  for (size_t i = 0; i < frame.size(); ++i) {
+    if (frame[i] == previous[i]) {
+      continue;
+    }
+    auto skip = i - end;
+    // Skips too long for one run are made up of empty ones.
+    for (; skip > 0xffff; skip -= 0xffff) {
+      runs += {char(0xff), char(0xff), char(0)};
+    }
+    runs += {char(skip & 0xff), char(skip >> 8)};
+    auto start = i, last_changed = i;
+    for (; i < frame.size() && i - start < 0xff; ++i) {
+      if (frame[i] != previous[i]) {
+        last_changed = i;
+      } else if (i - last_changed > kMaxRunGap) {
+        break;
+      }
+    }
+    end = last_changed + 1;
+    runs += char(end - start);
+    runs.append(frame.substr(start, end - start));
+    i = end - 1;
+  }
+  return runs;
+}
+
+}  // namespace
+
+EventHub::EventHub(async::Scheduler &main_scheduler)
+    : _main_scheduler{main_scheduler},
+      _heartbeat_work{_main_scheduler.schedule(
+          [this] { sendHeartbeat(); },
+          {.delay = kHeartbeatInterval, .period = kHeartbeatInterval})} {}
+
+EventHub::~EventHub() = default;
+
+http::Lifetime EventHub::subscribeStates(const StateDiff &states, http::RequestOptions opts) {
+  auto lifetime = subscribe(_state_subscribers, std::move(opts));
+  send(*_state_subscribers.back().lock(), makeEvent("states", toJson(states)));
+  return lifetime;
+}
+
+http::Lifetime EventHub::subscribeFrames(http::RequestOptions opts) {
+  auto lifetime = subscribe(_frame_subscribers, std::move(opts));
+  if (!_sent_frame.empty()) {
+    auto subscriber = _frame_subscribers.back().lock();
+    sendFrame(*subscriber, keyframe());
+    subscriber->needs_keyframe = false;
+    ++_keyframes_sent;
+  }
+  return lifetime;
+}
+
+void EventHub::publishStates(const StateDiff &diff) {
+  std::erase_if(_state_subscribers, [](auto &subscriber) { return subscriber.expired(); });
+  if (_state_subscribers.empty()) {
+    return;
+  }
+  auto event = makeEvent("states", toJson(diff));
+  for (auto &subscriber : _state_subscribers) {
+    send(*subscriber.lock(), event);
+  }
+}
+
+void EventHub::publishFrame(const render::Frame &frame) {
+  serialize(frame, _frame);
+  scheduleFrames();
+}
+
+http::Lifetime EventHub::subscribe(Subscribers &subscribers, http::RequestOptions opts) {
+  auto subscriber = std::make_shared<Subscriber>(Subscriber{.opts = std::move(opts)});
+  subscriber->opts.on_response(http::Response(200, {{"content-type", "text/event-stream"},
+                                                    {"cache-control", "no-cache"},
+                                                    {"transfer-encoding", "chunked"}}));
+  subscribers.push_back(subscriber);
+  return subscriber;
+}
+
+void EventHub::send(Subscriber &subscriber, const Event &event) {
+  subscriber.opts.on_bytes(subscriber.offset, *event, event);
+  subscriber.offset += event->size();
+}
+
+void EventHub::sendFrame(Subscriber &subscriber, const Event &event) {
+  subscriber.opts.on_bytes(subscriber.offset, *event,
+                           std::make_shared<FrameInFlight>(event, subscriber.frames_in_flight));
+  subscriber.offset += event->size();
+  ++_frames_sent;
+}
+
+void EventHub::scheduleFrames() {
+  if (_frames_scheduled) {
+    return;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - _last_frame_at;
+  if (elapsed >= kFrameInterval) {
+    return sendFrames();
+  }
+  _frames_scheduled = true;
+  _frame_work = _main_scheduler.schedule(
+      [this] {
+        _frames_scheduled = false;
+        sendFrames();
+      },
+      {.delay = std::chrono::ceil<std::chrono::milliseconds>(kFrameInterval - elapsed)});
+}
+
+void EventHub::sendFrames() {
+  _last_frame_at = std::chrono::steady_clock::now();
+  auto previous = std::exchange(_sent_frame, _frame);
+  auto changed = previous != _sent_frame;
+  if (changed) {
+    _keyframe.reset();
+  }
+
+  std::erase_if(_frame_subscribers, [](auto &subscriber) { return subscriber.expired(); });
+  auto delta_event = Event();
+  auto lagging = false;
+  for (auto &weak_subscriber : _frame_subscribers) {
+    auto subscriber = weak_subscriber.lock();
+    if (*subscriber->frames_in_flight > 0) {
+      if (changed) {
+        subscriber->needs_keyframe = true;
+        ++_frames_dropped;
+      }
+      lagging = lagging || subscriber->needs_keyframe;
+    } else if (subscriber->needs_keyframe || previous.size() != _sent_frame.size()) {
+      sendFrame(*subscriber, keyframe());
+      subscriber->needs_keyframe = false;
+      ++_keyframes_sent;
+    } else if (changed) {
+      if (!delta_event) {
+        delta_event = makeEvent("delta", encoding::base64::encode(delta(previous, _sent_frame)));
+      }
+      sendFrame(*subscriber, delta_event);
+    }
+  }
+  // Subscribers that skipped frames get the latest one once they catch up.
+  if (lagging) {
+    scheduleFrames();
+  }
+}
+
+const EventHub::Event &EventHub::keyframe() {
+  if (!_keyframe) {
+    _keyframe = makeEvent("keyframe", encoding::base64::encode(_sent_frame));
+  }
+  return _keyframe;
+}
+
+void EventHub::sendHeartbeat() {
+  for (auto *subscribers : {&_state_subscribers, &_frame_subscribers}) {
+    std::erase_if(*subscribers, [](auto &subscriber) { return subscriber.expired(); });
+    for (auto &weak_subscriber : *subscribers) {
+      auto subscriber = weak_subscriber.lock();
+      subscriber->opts.on_bytes(subscriber->offset, kHeartbeat, nullptr);
+      subscriber->offset += kHeartbeat.size();
+    }
+  }
+}
+
+}  // namespace web_proxy
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "async/scheduler.h"
+#include "http/http.h"
+#include "render/renderer.h"
+#include "state_thingy.h"
+
+namespace web_proxy {
+
+// Pushes state changes and the frames shown on the panel to local clients, as server-sent events.
+// Each event is serialized once, and the same buffer written to every subscriber.
+//
+// States come as "states" events, a JSON object with the data of each state that changed, or null
+// for those that were removed, starting with all of them. None of these are dropped.
+//
+// Frames come as "keyframe" events, with the width, height, logo and pixels of the frame, and
+// "delta" events, with the bytes that changed since the previous frame as runs of [skip, 2 bytes
+// little endian][count, 1 byte][count bytes]. Both are base64, with a byte per color channel. A
+// subscriber that is still sending a frame skips the ones that follow, and gets a keyframe once it
+// has caught up.
+class EventHub final {
+ public:
+  static constexpr auto kFrameInterval = std::chrono::milliseconds{100};
+  static constexpr auto kHeartbeatInterval = std::chrono::seconds{15};
+
+  explicit EventHub(async::Scheduler &main_scheduler);
+  ~EventHub();
+
+  // Answers with a stream of events, until the returned lifetime is dropped.
+  http::Lifetime subscribeStates(const StateDiff &states, http::RequestOptions);
+  http::Lifetime subscribeFrames(http::RequestOptions);
+
+  void publishStates(const StateDiff &);
+  // Sends frames at most every kFrameInterval, the latest one at the end of it.
+  void publishFrame(const render::Frame &);
+
+  uint64_t numFramesSent() const { return _frames_sent; }
+  uint64_t numFramesDropped() const { return _frames_dropped; }
+  uint64_t numKeyframesSent() const { return _keyframes_sent; }
+
+ private:
+  struct Subscriber {
+    http::RequestOptions opts;
+    int64_t offset = 0;
+    // Frames not yet written to the connection. Released on the server's thread.
+    std::shared_ptr<std::atomic<int>> frames_in_flight = std::make_shared<std::atomic<int>>();
+    bool needs_keyframe = true;
+  };
+  using Subscribers = std::vector<std::weak_ptr<Subscriber>>;
+  using Event = std::shared_ptr<std::string>;
+
+  http::Lifetime subscribe(Subscribers &, http::RequestOptions);
+  void send(Subscriber &, const Event &);
+  void sendFrame(Subscriber &, const Event &);
+  void scheduleFrames();
+  void sendFrames();
+  const Event &keyframe();
+  void sendHeartbeat();
+
+  async::Scheduler &_main_scheduler;
+  Subscribers _state_subscribers;
+  Subscribers _frame_subscribers;
+
+  // The latest frame and the one last sent, a byte per color channel after the size.
+  std::string _frame;
+  std::string _sent_frame;
+  Event _keyframe;
+  std::chrono::steady_clock::time_point _last_frame_at;
+  bool _frames_scheduled = false;
+  async::Lifetime _frame_work;
+  async::Lifetime _heartbeat_work;
+
+  uint64_t _frames_sent = 0;
+  uint64_t _frames_dropped = 0;
+  uint64_t _keyframes_sent = 0;
+};
+
+}  // namespace web_proxy
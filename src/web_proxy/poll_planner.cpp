@@ -0,0 +1,81 @@
+#include "poll_planner.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace web_proxy {
+namespace {
+
+using namespace std::chrono_literals;
+
+// How much earlier than asked a poll may go out: a tenth of its interval, up to a minute.
+constexpr auto kToleranceDivisor = 10;
+constexpr auto kMaxShift = std::chrono::milliseconds{1min};
+
+}  // namespace
+
+PollPlanner::PollPlanner(async::Scheduler &main_scheduler) : _main_scheduler{main_scheduler} {}
+
+PollPlanner::~PollPlanner() = default;
+
+async::Lifetime PollPlanner::plan(std::string id,
+                                  std::chrono::milliseconds interval,
+                                  async::Fn on_due) {
+  auto now = Clock::now();
+  auto due = now + interval;
+  auto shift = std::min(interval / kToleranceDivisor, kMaxShift);
+
+  // Join the latest slot within the window, or start a new one when the poll is due.
+  auto it = _slots.upper_bound(due);
+  if (it == _slots.begin() || std::prev(it)->first < due - shift) {
+    it = _slots.emplace_hint(it, due, PlannedSlot{});
+    it->second.work = _main_scheduler.schedule([this, due] { onSlotDue(due); },
+                                               {.delay = interval});
+  } else {
+    --it;
+  }
+
+  auto alive = std::make_shared<bool>();
+  it->second.polls.push_back({.id = std::move(id), .alive = alive, .on_due = std::move(on_due)});
+  return alive;
+}
+
+std::vector<PollPlanner::Slot> PollPlanner::planned() const {
+  auto slots = std::vector<Slot>();
+  for (auto &[at, slot] : _slots) {
+    auto ids = std::vector<std::string>();
+    for (auto &poll : slot.polls) {
+      if (!poll.alive.expired()) {
+        ids.push_back(poll.id);
+      }
+    }
+    if (!ids.empty()) {
+      slots.push_back({.at = at, .ids = std::move(ids)});
+    }
+  }
+  return slots;
+}
+
+void PollPlanner::onSlotDue(Clock::time_point at) {
+  auto node = _slots.extract(at);
+  if (node.empty()) {
+    return;
+  }
+  auto polls = std::move(node.mapped().polls);
+  auto num_due = std::count_if(polls.begin(), polls.end(),
+                               [](auto &poll) { return !poll.alive.expired(); });
+  if (!num_due) {
+    return;
+  }
+  ++_num_wakeups;
+  _num_polls += num_due;
+
+  for (auto &poll : polls) {
+    // Checked for each poll, as earlier ones may cancel later ones.
+    if (!poll.alive.expired()) {
+      poll.on_due();
+    }
+  }
+}
+
+}  // namespace web_proxy
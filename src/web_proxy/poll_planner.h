@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "async/scheduler.h"
+
+namespace web_proxy {
+
+// Lines up polls that are due around the same time, so that they go out together rather than
+// each waking up the radio on its own. A poll may be moved earlier by a fraction of its interval
+// to join a slot that is already planned, but it's never delayed.
+class PollPlanner final {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Slot {
+    Clock::time_point at;
+    std::vector<std::string> ids;
+  };
+
+  explicit PollPlanner(async::Scheduler &);
+  ~PollPlanner();
+
+  // Runs |on_due| in about |interval|, unless the returned lifetime is dropped before that.
+  async::Lifetime plan(std::string id, std::chrono::milliseconds interval, async::Fn on_due);
+
+  std::vector<Slot> planned() const;
+
+  uint64_t numPolls() const { return _num_polls; }
+  uint64_t numWakeups() const { return _num_wakeups; }
+
+ private:
+  struct Poll {
+    std::string id;
+    std::weak_ptr<void> alive;
+    async::Fn on_due;
+  };
+  struct PlannedSlot {
+    std::vector<Poll> polls;
+    async::Lifetime work;
+  };
+
+  void onSlotDue(Clock::time_point at);
+
+  async::Scheduler &_main_scheduler;
+  std::map<Clock::time_point, PlannedSlot> _slots;
+  uint64_t _num_polls = 0;
+  uint64_t _num_wakeups = 0;
+};
+
+}  // namespace web_proxy
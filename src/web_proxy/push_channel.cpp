@@ -0,0 +1,86 @@
+#include "push_channel.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+namespace web_proxy {
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr auto kInitialBackoff = std::chrono::milliseconds{1s};
+constexpr auto kMaxBackoff = std::chrono::milliseconds{1min};
+
+}  // namespace
+
+PushChannel::PushChannel(async::Scheduler &main_scheduler,
+                         http::Http &http,
+                         std::string url,
+                         std::string_view device_id,
+                         OnUpdate on_update)
+    : _main_scheduler{main_scheduler},
+      _http{http},
+      _url{std::move(url)},
+      _device_id{device_id},
+      _on_update{std::move(on_update)},
+      _parser{[this](auto &event) { onEvent(event); }},
+      _work{_main_scheduler.schedule([this] { connect(); })} {}
+
+PushChannel::~PushChannel() = default;
+
+void PushChannel::connect() {
+  auto headers = http::Headers{
+      {"accept", "text/event-stream"},
+      {"cache-control", "no-cache"},
+      // Compressing would have the server hold back events to fill its blocks.
+      {"accept-encoding", "identity"},
+      {"x-device-id", std::string(_device_id)},
+  };
+  if (auto &id = _parser.lastEventId(); !id.empty()) {
+    headers["last-event-id"] = id;
+  }
+  _parser.reset();
+  _connected = false;
+  ++_num_connects;
+
+  _work = _http.request(
+      {.url = _url, .headers = std::move(headers)},
+      {.post_to = _main_scheduler,
+       .on_response = [this](auto res) { onResponse(std::move(res)); },
+       .on_bytes = [this](auto, auto data, auto) { _connected ? _parser.feed(data) : void(); },
+       .on_done = [this] { onDone(); },
+       .always_stream = true});
+}
+
+void PushChannel::onResponse(http::Response res) {
+  _connected = res.status == 200;
+  if (_connected) {
+    std::cout << "push: connected" << std::endl;
+  } else {
+    std::cerr << "push: failed to connect (status " << res.status << ")" << std::endl;
+  }
+}
+
+void PushChannel::onEvent(const http::SseParser::Event &event) {
+  _backoff = {};
+  ++_num_events;
+  if (event.type == "message" || event.type == "state") {
+    _on_update(std::string(event.data));
+  }
+}
+
+void PushChannel::onDone() {
+  auto delay = _parser.retryMs() >= 0 ? std::chrono::milliseconds{_parser.retryMs()}
+                                      : kInitialBackoff;
+  // Back off while connections fail or end without delivering any events.
+  if (_backoff.count()) {
+    delay = std::min(std::max(2 * _backoff, delay), kMaxBackoff);
+  }
+  _backoff = delay;
+
+  std::cerr << "push: disconnected, reconnecting in " << delay.count() << "ms" << std::endl;
+  _work = _main_scheduler.schedule([this] { connect(); }, {.delay = delay});
+}
+
+}  // namespace web_proxy
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+#include "async/scheduler.h"
+#include "http/http.h"
+#include "http/sse_parser.h"
+
+namespace web_proxy {
+
+// Keeps a server-sent events subscription to the backend open and passes on the state updates it
+// pushes, each a JSON object keyed by state id. Reconnects with the id of the last event seen, so
+// that updates sent in between aren't missed.
+class PushChannel final {
+ public:
+  using OnUpdate = std::function<void(const std::string &json)>;
+
+  PushChannel(async::Scheduler &main_scheduler,
+              http::Http &,
+              std::string url,
+              std::string_view device_id,
+              OnUpdate);
+  ~PushChannel();
+
+  uint64_t numEvents() const { return _num_events; }
+  uint64_t numConnects() const { return _num_connects; }
+
+ private:
+  void connect();
+  void onResponse(http::Response);
+  void onEvent(const http::SseParser::Event &);
+  void onDone();
+
+  async::Scheduler &_main_scheduler;
+  http::Http &_http;
+  std::string _url;
+  std::string_view _device_id;
+  OnUpdate _on_update;
+
+  http::SseParser _parser;
+  bool _connected = false;
+  std::chrono::milliseconds _backoff = {};
+  async::Lifetime _work;
+
+  uint64_t _num_events = 0;
+  uint64_t _num_connects = 0;
+};
+
+}  // namespace web_proxy
@@ -22,6 +22,9 @@ using namespace std::chrono_literals;
 constexpr auto kStatesFilename = "states";
 
 constexpr auto kInitialRetryBackoff = 5s;
+constexpr auto kMaxRetryBackoff = 10min;
+
+constexpr auto kPollStatsInterval = 10min;
 
 auto toNumber(jv jv_val) {
   auto number = jv_get_kind(jv_val) == JV_KIND_NUMBER ? jv_number_value(jv_val) : 0;
@@ -29,6 +32,25 @@ auto toNumber(jv jv_val) {
   return number;
 }
 
+auto millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Ids of the states in an update.
+std::unordered_set<std::string> idsIn(const std::string &json) {
+  auto ids = std::unordered_set<std::string>();
+  auto jv_dict = jv_parse(json.c_str());
+  if (jv_get_kind(jv_dict) == JV_KIND_OBJECT) {
+    jv_object_foreach(jv_dict, jv_id, jv_val) {
+      ids.emplace(jv_string_value(jv_id));
+      jv_free(jv_id);
+      jv_free(jv_val);
+    }
+  }
+  jv_free(jv_dict);
+  return ids;
+}
+
 struct HumanReadableDuration {
   HumanReadableDuration(std::chrono::milliseconds d) : _d{d} {}
   friend auto &operator<<(std::ostream &os, const HumanReadableDuration &lhs) {
@@ -47,9 +69,13 @@ StateThingy::StateThingy(async::Scheduler &main_scheduler,
     : _main_scheduler(main_scheduler),
       _request_update(std::move(request_update)),
       _renderer(std::move(renderer)),
+      _poll_planner(main_scheduler),
       _load_work{_main_scheduler.schedule([this] { loadStates(); })},
       _save_work{
-          _main_scheduler.schedule([this] { saveStates(); }, {.delay = 10s, .period = 1min})} {
+          _main_scheduler.schedule([this] { saveStates(); }, {.delay = 10s, .period = 1min})},
+      _poll_stats_work{_main_scheduler.schedule([this] { logPollStats(); },
+                                                {.delay = kPollStatsInterval,
+                                                 .period = kPollStatsInterval})} {
   _renderer->add([this](auto &led, auto elapsed) { return onRender(led, elapsed); });
 }
 
@@ -71,6 +97,7 @@ void StateThingy::loadStates() {
     _request_update(std::move(id), state, {});
   }
   _snapshot = set;
+  publishStates();
 }
 
 void StateThingy::saveStates() {
@@ -88,13 +115,61 @@ void StateThingy::saveStates() {
   }
 }
 
+void StateThingy::logPollStats() {
+  auto polls = _poll_planner.numPolls();
+  if (polls == _logged_polls) {
+    return;
+  }
+  _logged_polls = polls;
+  std::cout << "polls: " << polls << " in " << _poll_planner.numWakeups() << " wakeups, "
+            << _polls_unchanged << " unchanged, " << _polls_changed << " changed" << std::endl;
+}
+
 const std::unordered_map<std::string, State> &StateThingy::states() { return _states; }
 
+State *StateThingy::findState(const std::string &id) {
+  auto it = _states.find(id);
+  return it != _states.end() ? &it->second : nullptr;
+}
+
+void StateThingy::publishStates() {
+  // Only written on this thread, so read without the lock.
+  static const auto kNone = Published();
+  auto &before = _published ? *_published : kNone;
+  auto states = std::make_shared<Published>();
+  states->reserve(_states.size());
+  auto diff = StateDiff();
+  for (auto &[id, state] : _states) {
+    auto it = before.find(id);
+    if (it != before.end() && it->second->response().body == state.data) {
+      states->emplace(id, it->second);
+      continue;
+    }
+    states->emplace(id, std::make_shared<const http::CachedResponse>(http::Response(state.data)));
+    diff.emplace(id, state.data);
+  }
+  for (auto &[id, res] : before) {
+    if (!states->contains(id)) {
+      diff.emplace(id, std::nullopt);
+    }
+  }
+  auto lock = std::unique_lock(_published_mutex);
+  auto previous = std::exchange(_published, states);
+  lock.unlock();
+
+  if (!_on_change) {
+    return;
+  }
+  if (!diff.empty()) {
+    _on_change(diff);
+  }
+}
+
 http::Lifetime StateThingy::handleRequest(http::Request &req, http::RequestOptions &opts) {
-  if (auto res = req.method == http::Method::GET ? handleGetRequest(req) : std::nullopt) {
+  if (auto cached = req.method == http::Method::GET ? handleGetRequest(req.url) : nullptr) {
     auto &post_to = opts.post_to;
     return post_to.schedule(
-        [res = std::move(*res), opts = std::move(opts)] { opts.on_response(std::move(res)); });
+        [res = cached->response(), opts = std::move(opts)] { opts.on_response(std::move(res)); });
   }
   if (req.method == http::Method::POST) {
     return handlePostRequest(req, std::move(opts));
@@ -102,20 +177,31 @@ http::Lifetime StateThingy::handleRequest(http::Request &req, http::RequestOptio
   return nullptr;
 }
 
-std::optional<http::Response> StateThingy::handleGetRequest(const http::Request &req) {
-  auto url = uri::Uri(req.url);
-  if (auto it = _states.find(std::string(url.path.full)); it != _states.end()) {
-    return it->second.data;
+std::shared_ptr<const http::CachedResponse> StateThingy::handleGetRequest(
+    std::string_view url) const {
+  auto states = [this] {
+    auto lock = std::unique_lock(_published_mutex);
+    return _published;
+  }();
+  if (!states) {
+    return nullptr;
   }
-  return {};
+  if (auto it = states->find(std::string(uri::Uri(url).path.full)); it != states->end()) {
+    return it->second;
+  }
+  return nullptr;
 }
 
-void StateThingy::updateState(std::string id) { _request_update(id, _states[id], {}); }
+void StateThingy::updateState(std::string id) {
+  _request_update(id, _states[id], {});
+  publishStates();
+}
 
 http::Lifetime StateThingy::handlePostRequest(const http::Request &req, http::RequestOptions opts) {
   auto url = uri::Uri(req.url);
   auto id = std::string(url.path.full);
   auto &state = _states[id];
+  publishStates();
 
   auto it = req.headers.find("content-type");
   auto content_type = it != req.headers.end() ? it->second : std::string_view();
@@ -137,7 +223,7 @@ http::Lifetime StateThingy::handlePostRequest(const http::Request &req, http::Re
   };
 
   if (content_type == "application/json") {
-    handleStateUpdate(req.body);
+    handleStateUpdate(req.body, false);
     reply();
   } else if (!req.body.empty() && content_type == "application/x-www-form-urlencoded") {
     _request_update(id + "?" + req.body, state, std::move(reply));
@@ -147,13 +233,16 @@ http::Lifetime StateThingy::handlePostRequest(const http::Request &req, http::Re
   return lifetime;
 }
 
-void StateThingy::handleStateUpdate(const std::string &json) {
+void StateThingy::handleStateUpdate(const std::string &json, bool from_backend) {
   auto jv_dict = jv_parse(json.c_str());
 
   if (jv_get_kind(jv_dict) != JV_KIND_OBJECT) {
     jv_free(jv_dict);
     return;
   }
+  if (from_backend && !std::exchange(_has_first_state, true)) {
+    std::cout << "Time to first state: " << millisecondsSince(_started_at) << "ms" << std::endl;
+  }
 
   // todo: split up this massive function?
   jv_object_foreach(jv_dict, jv_id, jv_val) {
@@ -244,6 +333,7 @@ void StateThingy::handleStateUpdate(const std::string &json) {
       if (jv_get_kind(jv_timeout) == JV_KIND_NUMBER) {
         auto delay = std::chrono::milliseconds{static_cast<int64_t>(jv_number_value(jv_timeout))};
         std::cout << id << ": updated, timeout in " << HumanReadableDuration(delay) << std::endl;
+        state.poll = {};
         state.work = _main_scheduler.schedule(
             [this, id, &state] {
               if (_displaying == &*state.display) {
@@ -251,6 +341,7 @@ void StateThingy::handleStateUpdate(const std::string &json) {
                 _renderer->notify();
               }
               _states.erase(id);
+              publishStates();
               std::cout << id << ": erased" << std::endl;
 
               if (auto *id = findNextToDisplay()) {
@@ -259,12 +350,12 @@ void StateThingy::handleStateUpdate(const std::string &json) {
             },
             {.delay = delay});
       } else if (jv_get_kind(jv_poll) == JV_KIND_NUMBER) {
-        auto delay = std::chrono::milliseconds{static_cast<int64_t>(jv_number_value(jv_poll))};
-        std::cout << id << ": updated, poll in " << HumanReadableDuration(delay) << std::endl;
-        state.work = _main_scheduler.schedule(
-            [this, id, &state] { _request_update(std::move(id), state, {}); }, {.delay = delay});
+        state.poll = std::chrono::milliseconds{static_cast<int64_t>(jv_number_value(jv_poll))};
+        std::cout << id << ": updated, poll in " << HumanReadableDuration(state.poll) << std::endl;
+        schedulePoll(id, state);
       } else {
         std::cout << id << ": updated" << std::endl;
+        state.poll = {};
         state.work = {};
       }
       jv_free(jv_poll);
@@ -287,33 +378,72 @@ void StateThingy::handleStateUpdate(const std::string &json) {
     jv_free(jv_val);
   }
   jv_free(jv_dict);
+  publishStates();
+}
+
+void StateThingy::schedulePoll(const std::string &id, State &state) {
+  state.work =
+      _poll_planner.plan(id, state.poll, [this, id, &state] { _request_update(id, state, {}); });
+}
+
+std::chrono::milliseconds StateThingy::randomDuration(std::chrono::milliseconds min,
+                                                      std::chrono::milliseconds max) {
+  return std::chrono::milliseconds{
+      std::uniform_int_distribution<int64_t>(min.count(), max.count())(_random)};
 }
 
 void StateThingy::onServiceResponse(http::Response res, std::string id, State &state) {
   if (res.status == 204) {
     return;
   }
+  // Only plain polls are conditional, requests with a query are actions.
+  auto is_poll = id.find('?') == std::string::npos;
+  // Polls are POSTs, which a server that follows RFC 9110 answers with 412 rather than 304 when
+  // the validator still matches.
+  if (res.status == 304 || (res.status == 412 && is_poll && !state.etag.empty())) {
+    ++_polls_unchanged;
+    state.retry_backoff = {};
+    auto num_polls = _polls_unchanged + _polls_changed;
+    std::cout << id << ": unchanged (" << 100 * _polls_unchanged / num_polls << "% of polls)";
+    if (state.poll.count()) {
+      std::cout << ", poll in " << HumanReadableDuration(state.poll);
+      schedulePoll(id, state);
+    }
+    std::cout << std::endl;
+    return;
+  }
   if (res.status == 200) {
+    _polls_changed += is_poll;
     state.retry_backoff = {};
+    auto it = res.headers.find("etag");
+    state.etag = is_poll && it != res.headers.end() ? std::move(it->second) : std::string();
     return handleStateUpdate(res.body);
   }
 
   if (res.status == 404) {
     std::cerr << id << ": update failed (status " << res.status << "), erasing" << std::endl;
     _states.erase(id);
+    publishStates();
     return;
   }
-  if (res.status == 429 || res.status == 503) {
-    if (auto it = res.headers.find("retry-after"); it != res.headers.end()) {
-      auto &str = it->second;
-      if (int s = 0; std::from_chars(str.data(), str.data() + str.size(), s).ec == std::errc{}) {
-        state.retry_backoff = std::chrono::seconds(s);
-      }
+  auto retry_after = std::optional<std::chrono::milliseconds>();
+  if (auto it = res.headers.find("retry-after");
+      (res.status == 429 || res.status == 503) && it != res.headers.end()) {
+    auto &str = it->second;
+    if (int s = 0; std::from_chars(str.data(), str.data() + str.size(), s).ec == std::errc{}) {
+      retry_after = std::chrono::seconds(s);
     }
+  }
+  if (retry_after) {
+    // Spread out devices that were all told the same time.
+    auto spread = std::max<std::chrono::milliseconds>(1s, *retry_after / 5);
+    state.retry_backoff = *retry_after + randomDuration(0ms, spread);
   } else {
-    state.retry_backoff = state.retry_backoff.count()
-                              ? std::min<std::chrono::milliseconds>(2 * state.retry_backoff, 10min)
-                              : kInitialRetryBackoff;
+    // Decorrelated jitter: grows about threefold per attempt, without devices that failed at the
+    // same time retrying in lockstep.
+    auto max = std::max<std::chrono::milliseconds>(kInitialRetryBackoff, 3 * state.retry_backoff);
+    state.retry_backoff = std::min<std::chrono::milliseconds>(
+        randomDuration(kInitialRetryBackoff, max), kMaxRetryBackoff);
   }
 
   std::cerr << id << ": update failed (status " << res.status << "), retrying in "
@@ -323,6 +453,32 @@ void StateThingy::onServiceResponse(http::Response res, std::string id, State &s
       {.delay = state.retry_backoff});
 }
 
+void StateThingy::onBatchResponse(http::Response res, const std::vector<std::string> &ids) {
+  if (res.status != 200) {
+    for (auto &id : ids) {
+      if (auto *state = findState(id)) {
+        onServiceResponse(res, id, *state);
+      }
+    }
+    return;
+  }
+  for (auto &id : ids) {
+    if (auto *state = findState(id)) {
+      state->retry_backoff = {};
+    }
+  }
+  handleStateUpdate(res.body);
+
+  // The backend only includes states it has news of. The rest poll again as they would have.
+  auto updated = idsIn(res.body);
+  for (auto &id : ids) {
+    auto *state = findState(id);
+    if (!updated.contains(id) && state && state->poll.count()) {
+      schedulePoll(id, *state);
+    }
+  }
+}
+
 const std::string *StateThingy::findNextToDisplay() const {
   std::map<Display::Prio, const std::string *> id_by_display_prio;
   for (auto &[id, state] : _states) {
@@ -337,6 +493,12 @@ std::chrono::milliseconds StateThingy::onRender(render::LED &led,
                                                 std::chrono::milliseconds elapsed) {
   if (_displaying) {
     _displaying->onRenderPass(led, elapsed);
+    if (!std::exchange(_has_first_pixel, true)) {
+      _renderer->afterNextShow([this] {
+        std::cout << "Time to first pixel: " << millisecondsSince(_started_at) << "ms"
+                  << std::endl;
+      });
+    }
 
     if (_displaying->xscroll || _displaying->wave) {
       return 100ms;
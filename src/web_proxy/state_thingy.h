@@ -2,14 +2,21 @@
 
 #include <chrono>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "async/scheduler.h"
 #include "display.h"
 #include "http/http.h"
+#include "http/server/response_serializer.h"
+#include "poll_planner.h"
 #include "render/renderer.h"
 
 namespace web_proxy {
@@ -17,13 +24,26 @@ namespace web_proxy {
 struct State {
   std::string data;
   std::optional<Display> display;
+  // Validator of the last update, sent along with polls so that unchanged states aren't resent.
+  std::string etag;
+  std::chrono::milliseconds poll = {};
   std::chrono::milliseconds retry_backoff = {};
   async::Lifetime work;
 };
 
+// Conditional polls, by whether the state had changed since the previous one.
+struct PollStats {
+  uint64_t unchanged = 0;
+  uint64_t changed = 0;
+};
+
+// The data of states that changed, and nullopt for those that were removed.
+using StateDiff = std::map<std::string, std::optional<std::string>>;
+
 struct StateThingy final {
   using RequestUpdate =
       std::function<void(std::string id, State &, std::function<void()> on_update)>;
+  using OnChange = std::function<void(const StateDiff &)>;
 
   StateThingy(async::Scheduler &main_scheduler,
               RequestUpdate request_update,
@@ -31,30 +51,66 @@ struct StateThingy final {
   ~StateThingy();
 
   const std::unordered_map<std::string, State> &states();
+  State *findState(const std::string &id);
 
   http::Lifetime handleRequest(http::Request &, http::RequestOptions &);
+  // Answers a GET for a state from the data as of its last update, serialized once per update.
+  // Returns null for unknown states. Safe to call on any thread.
+  std::shared_ptr<const http::CachedResponse> handleGetRequest(std::string_view url) const;
   void updateState(std::string id);
+  // Called with what changed each time updates are applied.
+  void setOnChange(OnChange on_change) { _on_change = std::move(on_change); }
+  render::Renderer &renderer() { return *_renderer; }
 
-  void handleStateUpdate(const std::string &json);
+  // |from_backend| is false for states that local clients post themselves.
+  void handleStateUpdate(const std::string &json, bool from_backend = true);
   void onServiceResponse(http::Response, std::string id, State &);
+  void onBatchResponse(http::Response, const std::vector<std::string> &ids);
+
+  PollStats pollStats() const { return {.unchanged = _polls_unchanged, .changed = _polls_changed}; }
 
  private:
   void loadStates();
   void saveStates();
+  // Logs how many polls went out together, and how many found their state unchanged.
+  void logPollStats();
 
-  std::optional<http::Response> handleGetRequest(const http::Request &);
+  void publishStates();
   http::Lifetime handlePostRequest(const http::Request &, http::RequestOptions);
 
+  void schedulePoll(const std::string &id, State &);
+  std::chrono::milliseconds randomDuration(std::chrono::milliseconds min,
+                                           std::chrono::milliseconds max);
+
   const std::string *findNextToDisplay() const;
   std::chrono::milliseconds onRender(render::LED &led, std::chrono::milliseconds elapsed);
 
   async::Scheduler &_main_scheduler;
   RequestUpdate _request_update;
   std::unique_ptr<render::Renderer> _renderer;
+  PollPlanner _poll_planner;
+  std::mt19937 _random{std::random_device{}()};
   std::unordered_map<std::string, State> _states;
   std::unordered_set<std::string> _snapshot;
+  // The response to GETs for each state, replaced as a whole on every update so that other
+  // threads can keep reading the one they have without holding the lock. Responses of states
+  // that didn't change are carried over rather than serialized again.
+  using Published = std::unordered_map<std::string, std::shared_ptr<const http::CachedResponse>>;
+  mutable std::mutex _published_mutex;
+  std::shared_ptr<const Published> _published;
+  OnChange _on_change;
   Display *_displaying = nullptr;
-  async::Lifetime _load_work, _save_work;
+  async::Lifetime _load_work, _save_work, _poll_stats_work;
+
+  uint64_t _polls_unchanged = 0;
+  uint64_t _polls_changed = 0;
+  // Polls as of the last log, so that nothing is logged while there are none.
+  uint64_t _logged_polls = 0;
+
+  // For logging how long it takes from startup until the panel shows something.
+  std::chrono::steady_clock::time_point _started_at = std::chrono::steady_clock::now();
+  bool _has_first_state = false;
+  bool _has_first_pixel = false;
 };
 
 }  // namespace web_proxy
@@ -0,0 +1,142 @@
+#include "web_proxy/web_proxy.h"
+
+#include <unistd.h>
+
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "http/server/server.h"
+#include "render/renderer_impl.h"
+
+// Updates two states together against a local backend that takes a while to answer the batch,
+// and changes one of them while the batch is in flight. Checks that the change goes out once the
+// batch is back, rather than being folded into the batch that was sent with the old data.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr auto kBatchDelay = 200ms;
+
+struct FakeLED final : render::BufferedLED {
+  void clear() final {}
+  void show() final {}
+  render::Coord size() const final { return {23, 16}; }
+  void setLogo(Color, const Options &) final {}
+  void set(render::Coord, Color, const Options &) final {}
+};
+
+void onMain(async::Scheduler &scheduler, std::function<void()> fn) {
+  std::promise<void> done;
+  auto _ = scheduler.schedule([&] {
+    fn();
+    done.set_value();
+  });
+  done.get_future().get();
+}
+
+}  // namespace
+
+int main() {
+  // States are saved to and loaded from the working directory.
+  auto dir = std::filesystem::temp_directory_path() / ("batch_test." + std::to_string(getpid()));
+  std::filesystem::create_directory(dir);
+  std::filesystem::current_path(dir);
+
+  auto main_thread = async::Thread::create("main");
+  auto &main_scheduler = main_thread->scheduler();
+
+  // Requests to the backend, as "<path> <body>", and when they arrived.
+  auto received = std::vector<std::string>();
+  auto batch_answered_at = std::chrono::steady_clock::time_point();
+  auto update_at = std::chrono::steady_clock::time_point();
+  std::promise<void> batch_received, update_received;
+  std::unique_ptr<http::Server> server;
+  std::vector<async::Lifetime> answers;
+  onMain(main_scheduler, [&] {
+    auto handler = [&](http::Request req, http::RequestOptions opts) -> http::Lifetime {
+      if (req.method == http::Method::HEAD) {
+        opts.on_response(200);
+        return nullptr;
+      }
+      received.push_back(req.url + " " + req.body);
+      if (req.url == "/batch") {
+        batch_received.set_value();
+        auto answer = main_scheduler.schedule(
+            [&batch_answered_at, on_response = opts.on_response] {
+              batch_answered_at = std::chrono::steady_clock::now();
+              on_response(http::Response("{}"));
+            },
+            {.delay = kBatchDelay});
+        answers.push_back(answer);
+        return answer;
+      }
+      if (req.url == "/a") {
+        update_at = std::chrono::steady_clock::now();
+        update_received.set_value();
+      }
+      opts.on_response(http::Response("{}"));
+      return nullptr;
+    };
+    server = http::makeServer(main_scheduler, handler, {.port = 0});
+  });
+
+  auto http = http::Http::create();
+  auto url = "http://127.0.0.1:" + std::to_string(server->port());
+  std::unique_ptr<web_proxy::WebProxy> proxy;
+
+  // Posts states to the proxy as a local client would.
+  auto post = [&](std::string json) {
+    auto handler = proxy->asRequestHandler();
+    auto work = std::make_shared<http::Lifetime>();
+    *work = handler({.method = http::Method::POST,
+                     .url = "/a",
+                     .headers = {{"content-type", "application/json"}},
+                     .body = std::move(json)},
+                    {.post_to = main_scheduler, .on_response = [work](auto res) {
+                       assert(res.status == 200);
+                       work->reset();
+                     }});
+  };
+
+  onMain(main_scheduler, [&] {
+    proxy = std::make_unique<web_proxy::WebProxy>(
+        main_scheduler, *http, render::createRenderer(main_scheduler, std::make_unique<FakeLED>()),
+        url, "test");
+    post(R"({"/a": {"data": "a1"}, "/b": {"data": "b1"}})");
+    proxy->updateState("/a");
+    proxy->updateState("/b");
+  });
+
+  batch_received.get_future().get();
+  onMain(main_scheduler, [&] {
+    assert(received.size() == 1);
+    assert(received[0].find("a1") != std::string::npos);
+    post(R"({"/a": {"data": "a2"}})");
+    proxy->updateState("/a");
+  });
+
+  // Never, if the change was folded into the batch.
+  auto update = update_received.get_future();
+  auto status = update.wait_for(kBatchDelay + 5s);
+  assert(status == std::future_status::ready);
+  onMain(main_scheduler, [&] {
+    assert(received.size() == 2);
+    assert(received[1] == "/a a2");
+    assert(update_at >= batch_answered_at);
+    std::cout << "Update made while the batch was in flight went out after it" << std::endl;
+
+    proxy.reset();
+    answers.clear();
+    server.reset();
+  });
+
+  std::filesystem::current_path(dir.parent_path());
+  std::filesystem::remove_all(dir);
+}
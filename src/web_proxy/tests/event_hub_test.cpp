@@ -0,0 +1,200 @@
+#include "web_proxy/event_hub.h"
+
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoding/base64.h"
+
+// Subscribes clients to states and frames, one of them slow to write what it gets, and checks
+// that all of them end up with the same frame, that each event is serialized once for all, and
+// that the slow client skips frames rather than queueing them.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr auto kSize = render::Coord{23, 16};
+
+struct Client {
+  std::string received;
+  std::vector<const char *> pieces;
+  // A slow client holds on to what it was sent, as if it was still being written.
+  bool slow = false;
+  std::vector<http::Lifetime> held;
+  http::Lifetime subscription;
+};
+
+http::RequestOptions optionsFor(async::Scheduler &scheduler, Client &client) {
+  return {.post_to = scheduler,
+          .on_response =
+              [](http::Response res) {
+                assert(res.status == 200);
+                assert(res.headers["content-type"] == "text/event-stream");
+              },
+          .on_bytes =
+              [&client](auto, auto data, auto lifetime) {
+                client.received += data;
+                client.pieces.push_back(data.data());
+                if (client.slow) {
+                  client.held.push_back(std::move(lifetime));
+                }
+              }};
+}
+
+void onMain(async::Scheduler &scheduler, std::function<void()> fn) {
+  std::promise<void> done;
+  auto _ = scheduler.schedule([&] {
+    fn();
+    done.set_value();
+  });
+  done.get_future().get();
+}
+
+render::Frame makeFrame(int seed) {
+  auto frame = render::Frame{.size = kSize, .logo = Color(seed)};
+  frame.pixels.resize(kSize.x * kSize.y);
+  // Changes a few pixels from one seed to the next.
+  for (int i = 0; i < 8; ++i) {
+    frame.pixels[(seed * 37 + i * 11) % frame.pixels.size()] = Color(seed, i, 255);
+  }
+  return frame;
+}
+
+std::string bytesOf(const render::Frame &frame) {
+  auto bytes = std::string{char(frame.size.x), char(frame.size.y)};
+  bytes.append(frame.logo.begin(), frame.logo.end());
+  for (auto &color : frame.pixels) {
+    bytes.append(color.begin(), color.end());
+  }
+  return bytes;
+}
+
+// Plays back the frame events a client got, returning the last frame and the number of events.
+std::pair<std::string, int> playBack(std::string_view received) {
+  auto frame = std::string();
+  int num_events = 0;
+  for (size_t end; (end = received.find("\n\n")) != std::string_view::npos;
+       received.remove_prefix(end + 2)) {
+    auto event = received.substr(0, end);
+    if (event.starts_with(":")) {
+      continue;
+    }
+    ++num_events;
+    auto data = encoding::base64::decode(event.substr(event.find("data: ") + 6));
+    if (event.starts_with("event: keyframe\n")) {
+      frame = data;
+      continue;
+    }
+    assert(event.starts_with("event: delta\n"));
+    size_t offset = 0;
+    for (size_t i = 0; i < data.size();) {
+      offset += uint8_t(data[i]) | uint8_t(data[i + 1]) << 8;
+      auto count = uint8_t(data[i + 2]);
+      frame.replace(offset, count, data, i + 3, count);
+      offset += count;
+      i += 3 + count;
+    }
+  }
+  return {frame, num_events};
+}
+
+void testFrames(async::Scheduler &scheduler) {
+  auto hub = std::make_unique<web_proxy::EventHub>(scheduler);
+  Client fast1, fast2, slow{.slow = true};
+  onMain(scheduler, [&] {
+    for (auto *client : {&fast1, &fast2, &slow}) {
+      client->subscription = hub->subscribeFrames(optionsFor(scheduler, *client));
+    }
+    hub->publishFrame(makeFrame(1));
+  });
+  assert(playBack(slow.received).first == bytesOf(makeFrame(1)));
+
+  // The slow client is still sending the first frame, and skips the second.
+  std::this_thread::sleep_for(web_proxy::EventHub::kFrameInterval);
+  onMain(scheduler, [&] { hub->publishFrame(makeFrame(2)); });
+  assert(fast1.pieces.size() == 2 && fast2.pieces.size() == 2 && slow.pieces.size() == 1);
+  // Sent to both from the same buffer.
+  assert(fast1.pieces.back() == fast2.pieces.back());
+  assert(hub->numFramesDropped() == 1);
+
+  // Once it has caught up, it gets the frame it missed in full.
+  onMain(scheduler, [&] { slow.held.clear(); });
+  std::this_thread::sleep_for(2 * web_proxy::EventHub::kFrameInterval);
+  onMain(scheduler, [] {});
+  assert(slow.pieces.size() == 2);
+  assert(playBack(slow.received).first == bytesOf(makeFrame(2)));
+  assert(hub->numKeyframesSent() == 4);
+
+  // Frames within the interval are folded into the last of them.
+  onMain(scheduler, [&] {
+    slow.slow = false;
+    slow.held.clear();
+  });
+  std::this_thread::sleep_for(web_proxy::EventHub::kFrameInterval);
+  onMain(scheduler, [&] {
+    for (int seed = 3; seed <= 6; ++seed) {
+      hub->publishFrame(makeFrame(seed));
+    }
+  });
+  std::this_thread::sleep_for(2 * web_proxy::EventHub::kFrameInterval);
+  onMain(scheduler, [] {});
+  for (auto *client : {&fast1, &fast2, &slow}) {
+    auto [frame, num_events] = playBack(client->received);
+    assert(frame == bytesOf(makeFrame(6)));
+    assert(num_events == 4);
+  }
+  // A late subscriber starts with the frame last sent.
+  Client late;
+  onMain(scheduler, [&] { late.subscription = hub->subscribeFrames(optionsFor(scheduler, late)); });
+  assert(playBack(late.received).first == bytesOf(makeFrame(6)));
+
+  std::cout << "Frames sent: " << hub->numFramesSent() << ", keyframes "
+            << hub->numKeyframesSent() << ", dropped " << hub->numFramesDropped()
+            << ", last delta " << fast1.received.size() - fast1.received.rfind("event:")
+            << " bytes against a keyframe of " << late.received.size() << std::endl;
+
+  onMain(scheduler, [&] {
+    fast1.subscription = fast2.subscription = slow.subscription = late.subscription = nullptr;
+    hub.reset();
+  });
+}
+
+void testStates(async::Scheduler &scheduler) {
+  auto hub = std::make_unique<web_proxy::EventHub>(scheduler);
+  Client client1, client2;
+  onMain(scheduler, [&] {
+    client1.subscription = hub->subscribeStates({{"/a", "1"}}, optionsFor(scheduler, client1));
+    client2.subscription = hub->subscribeStates({}, optionsFor(scheduler, client2));
+    hub->publishStates({{"/b", std::nullopt}});
+    // Dropped subscribers get nothing more.
+    client2.subscription = nullptr;
+    hub->publishStates({{"/a", "2"}});
+  });
+  assert(client1.received ==
+         "event: states\ndata: {\"/a\":\"1\"}\n\n"
+         "event: states\ndata: {\"/b\":null}\n\n"
+         "event: states\ndata: {\"/a\":\"2\"}\n\n");
+  assert(client2.received ==
+         "event: states\ndata: {}\n\n"
+         "event: states\ndata: {\"/b\":null}\n\n");
+  assert(client1.pieces[1] == client2.pieces[1]);
+  std::cout << "States sent to each subscriber" << std::endl;
+
+  onMain(scheduler, [&] {
+    client1.subscription = nullptr;
+    hub.reset();
+  });
+}
+
+}  // namespace
+
+int main() {
+  auto main_thread = async::Thread::create("main");
+  testFrames(main_thread->scheduler());
+  testStates(main_thread->scheduler());
+}
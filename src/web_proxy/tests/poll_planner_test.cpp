@@ -0,0 +1,79 @@
+#include "web_proxy/poll_planner.h"
+
+#include <cassert>
+#include <future>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+int main(int argc, char *argv[]) {
+  auto main_thread = async::Thread::create("main");
+  auto &main_scheduler = main_thread->scheduler();
+
+  auto planner = std::optional<web_proxy::PollPlanner>();
+  auto fired = std::vector<std::pair<std::string, web_proxy::PollPlanner::Clock::time_point>>();
+  auto lifetimes = std::vector<async::Lifetime>();
+  std::promise<void> done;
+
+  auto plan = [&](std::string id, std::chrono::milliseconds interval) {
+    lifetimes.push_back(planner->plan(id, interval, [&, id] {
+      fired.emplace_back(id, web_proxy::PollPlanner::Clock::now());
+      if (fired.size() == 4) {
+        done.set_value();
+      }
+    }));
+  };
+
+  std::promise<void> planned;
+  auto _ = main_scheduler.schedule([&] {
+    planner.emplace(main_scheduler);
+
+    // a opens a slot, b and c are due within a tenth of their interval after it and join.
+    plan("a", 1000ms);
+    plan("b", 1050ms);
+    plan("c", 1090ms);
+    // d is due too long after the slot and gets its own.
+    plan("d", 1300ms);
+    // e is cancelled before it's due.
+    plan("e", 1000ms);
+    lifetimes.pop_back();
+
+    auto slots = planner->planned();
+    for (auto &slot : slots) {
+      std::cout << "slot in "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(
+                       slot.at - web_proxy::PollPlanner::Clock::now())
+                       .count()
+                << "ms:";
+      for (auto &id : slot.ids) {
+        std::cout << " " << id;
+      }
+      std::cout << std::endl;
+    }
+    assert(slots.size() == 2);
+    assert((slots[0].ids == std::vector<std::string>{"a", "b", "c"}));
+    assert((slots[1].ids == std::vector<std::string>{"d"}));
+    planned.set_value();
+  });
+  planned.get_future().get();
+
+  done.get_future().get();
+  std::promise<void> checked;
+  auto check = main_scheduler.schedule([&] {
+    assert(fired.size() == 4);
+    assert(fired[0].first == "a" && fired[1].first == "b" && fired[2].first == "c");
+    assert(fired[2].second - fired[0].second < 10ms);
+    assert(fired[3].first == "d" && fired[3].second - fired[0].second > 250ms);
+    assert(planner->numPolls() == 4 && planner->numWakeups() == 2);
+    std::cout << planner->numPolls() << " polls in " << planner->numWakeups() << " wakeups"
+              << std::endl;
+    planner.reset();
+    checked.set_value();
+  });
+  checked.get_future().get();
+
+  std::cout << "OK" << std::endl;
+}
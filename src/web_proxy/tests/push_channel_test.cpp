@@ -0,0 +1,98 @@
+#include "web_proxy/push_channel.h"
+
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "http/server/server.h"
+
+// Pushes bursts of events from a local server that drops the stream every so often, and checks
+// that the channel picks up where it left off. Reports the event rate.
+
+namespace {
+
+constexpr int kEventsPerConnection = 10000;
+constexpr int kConnections = 5;
+// Odd, so that chunks split lines and CRLF pairs.
+constexpr size_t kChunkSize = 997;
+
+std::string makeEvents(int first_id) {
+  auto events = std::string(": keep-alive\r\nretry: 10\r\n\r\n");
+  for (auto id = first_id; id < first_id + kEventsPerConnection; ++id) {
+    auto line_end = id % 3 == 0 ? "\r\n" : id % 3 == 1 ? "\n" : "\r";
+    events += "id: " + std::to_string(id) + line_end;
+    events += "event: state" + std::string(line_end);
+    events += "data: {\"/s\": {\"data\": \"" + std::to_string(id) + "\"}}" + line_end + line_end;
+  }
+  return events;
+}
+
+}  // namespace
+
+int main() {
+  auto main_thread = async::Thread::create("main");
+  auto &main_scheduler = main_thread->scheduler();
+
+  int connections = 0;
+  std::unique_ptr<http::Server> server;
+  std::promise<void> started;
+  auto _ = main_scheduler.schedule([&] {
+    auto handler = [&](http::Request req, http::RequestOptions opts) {
+      assert(req.headers["accept"] == "text/event-stream");
+      assert(req.headers["x-device-id"] == "test");
+      ++connections;
+
+      auto first_id = 1;
+      if (auto it = req.headers.find("last-event-id"); it != req.headers.end()) {
+        first_id = std::stoi(it->second) + 1;
+      }
+      auto events = std::make_shared<std::string>(makeEvents(first_id));
+      opts.on_response(http::Response(200, {{"content-type", "text/event-stream"},
+                                            {"content-length", std::to_string(events->size())}}));
+      for (size_t offset = 0; offset < events->size(); offset += kChunkSize) {
+        opts.on_bytes(offset, std::string_view(*events).substr(offset, kChunkSize), events);
+      }
+      return http::Lifetime();
+    };
+    server = http::makeServer(main_scheduler, handler, {.port = 0});
+    started.set_value();
+  });
+  started.get_future().get();
+
+  auto http = http::Http::create();
+  auto url = "http://127.0.0.1:" + std::to_string(server->port()) + "/events";
+
+  auto channel = std::optional<web_proxy::PushChannel>();
+  int received = 0;
+  std::promise<void> done;
+
+  auto start = std::chrono::steady_clock::now();
+  auto connect = main_scheduler.schedule([&] {
+    channel.emplace(main_scheduler, *http, url, "test", [&](const std::string &json) {
+      // Each update is pushed exactly once, in order, across reconnects.
+      assert(json == "{\"/s\": {\"data\": \"" + std::to_string(received + 1) + "\"}}");
+      if (++received == kEventsPerConnection * kConnections) {
+        done.set_value();
+      }
+    });
+  });
+  done.get_future().get();
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  std::promise<void> stopped;
+  auto stop = main_scheduler.schedule([&] {
+    assert(channel->numEvents() == uint64_t(received));
+    assert(connections == kConnections);
+    channel.reset();
+    server.reset();
+    stopped.set_value();
+  });
+  stopped.get_future().get();
+
+  std::cout << received << " events over " << connections << " connections: "
+            << int(received / elapsed.count()) << " events/s" << std::endl;
+}
@@ -1,5 +1,10 @@
 #include "web_proxy.h"
 
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <utility>
+
 #include "encoding/base64.h"
 #include "uri/uri.h"
 
@@ -11,7 +16,25 @@ namespace web_proxy {
 namespace {
 
 constexpr auto kHostHeader = "host";
+constexpr auto kAcceptEncodingHeader = "accept-encoding";
 constexpr auto kDefaultBaseUrl = "https://spotiled.deno.dev";
+// Served locally rather than proxied, as server-sent events.
+constexpr auto kStateEventsPath = "/live/states";
+constexpr auto kFrameEventsPath = "/live/frames";
+
+constexpr auto kBatchWindow = std::chrono::milliseconds{50};
+// A state update taking longer than this fails with a 504 and is retried like any other failure.
+constexpr auto kUpdateTimeout = std::chrono::milliseconds{std::chrono::seconds{20}};
+// Well within the two minutes curl keeps idle connections for.
+constexpr auto kKeepAliveInterval = std::chrono::seconds{30};
+
+std::function<void()> callAll(std::vector<std::function<void()>> fns) {
+  return [fns = std::move(fns)] {
+    for (auto &fn : fns) {
+      fn();
+    }
+  };
+}
 
 }  // namespace
 
@@ -25,12 +48,20 @@ WebProxy::WebProxy(async::Scheduler &main_scheduler,
       _base_url{base_url.empty() ? kDefaultBaseUrl : std::move(base_url)},
       _base_host{uri::Uri(_base_url).authority.host},
       _device_id{device_id},
+      _event_hub{std::make_unique<EventHub>(_main_scheduler)},
       _state_thingy{std::make_unique<StateThingy>(
           _main_scheduler,
           [this](auto id, auto &state, auto on_update) {
             requestStateUpdate(std::move(id), state, std::move(on_update));
           },
-          std::move(renderer))} {}
+          std::move(renderer))},
+      // Runs right away, opening the connection while the persisted states are loaded.
+      _keep_alive_work{
+          _main_scheduler.schedule([this] { keepAlive(); }, {.period = kKeepAliveInterval})} {
+  _state_thingy->setOnChange([this](auto &diff) { _event_hub->publishStates(diff); });
+  _state_thingy->renderer().setFrameObserver(
+      [this](auto &frame) { _event_hub->publishFrame(frame); });
+}
 
 WebProxy::~WebProxy() = default;
 
@@ -38,14 +69,44 @@ WebProxy::RequestHandler WebProxy::asRequestHandler() {
   return [this](auto req, auto opts) { return handleRequest(std::move(req), std::move(opts)); };
 }
 
+WebProxy::FastHandler WebProxy::asFastHandler() {
+  return [this](auto &req) -> std::shared_ptr<const http::CachedResponse> {
+    if (req.method != http::Method::GET) {
+      return nullptr;
+    }
+    return _state_thingy->handleGetRequest(backendUrl(req.url));
+  };
+}
+
 void WebProxy::updateState(std::string id) { _state_thingy->updateState(id); }
 
+void WebProxy::enablePush() {
+  _push_channel = std::make_unique<PushChannel>(
+      _main_scheduler, _http, _base_url + "/events", _device_id,
+      [this](auto &json) { _state_thingy->handleStateUpdate(json); });
+}
+
+std::string WebProxy::backendUrl(std::string_view url) const {
+  if (url.empty() || url[0] == '*') {
+    return _base_url;
+  } else if (url[0] == '/') {
+    return _base_url + std::string(url);
+  }
+  return std::string(url);
+}
+
 http::Lifetime WebProxy::handleRequest(http::Request req, http::RequestOptions opts) {
-  if (req.url.empty() || req.url[0] == '*') {
-    req.url = _base_url;
-  } else if (req.url[0] == '/') {
-    req.url = _base_url + req.url;
+  if (req.method == http::Method::GET && req.url == kStateEventsPath) {
+    auto states = StateDiff();
+    for (auto &[id, state] : _state_thingy->states()) {
+      states.emplace(id, state.data);
+    }
+    return _event_hub->subscribeStates(states, std::move(opts));
+  }
+  if (req.method == http::Method::GET && req.url == kFrameEventsPath) {
+    return _event_hub->subscribeFrames(std::move(opts));
   }
+  req.url = backendUrl(req.url);
 
   if (auto lifetime = _state_thingy->handleRequest(req, opts)) {
     return lifetime;
@@ -67,23 +128,173 @@ http::Lifetime WebProxy::handleRequest(http::Request req, http::RequestOptions o
   jv_free(jv);
 
   req.headers["x-device-id"] = _device_id;
+  // The body is passed through as is, so only ask for an encoding the client can decode.
+  req.headers.try_emplace(kAcceptEncodingHeader, "identity");
+
+  _last_request_at = std::chrono::steady_clock::now();
 
   return _http.request(std::move(req), std::move(opts));
 }
 
 void WebProxy::requestStateUpdate(std::string id, State &state, std::function<void()> on_update) {
+  // Requests with a query are actions, and go out on their own.
+  if (!_batching || id.find('?') != std::string::npos) {
+    return requestSingleUpdate(std::move(id), state, std::move(on_update));
+  }
+  auto on_updates = std::vector<std::function<void()>>();
+  on_update ? on_updates.push_back(std::move(on_update)) : void();
+  // The data may have changed since the batch went out, so it goes out again once that is back.
+  if (_in_flight_updates.contains(id)) {
+    auto &dirty = _dirty_updates[std::move(id)];
+    std::move(on_updates.begin(), on_updates.end(), std::back_inserter(dirty));
+    return;
+  }
+  queueUpdate(std::move(id), std::move(on_updates));
+}
+
+void WebProxy::queueUpdate(std::string id, std::vector<std::function<void()>> on_updates) {
+  if (_pending_updates.empty()) {
+    _batch_work = _main_scheduler.schedule([this] { sendBatch(); }, {.delay = kBatchWindow});
+  }
+  auto &pending = _pending_updates[std::move(id)];
+  std::move(on_updates.begin(), on_updates.end(), std::back_inserter(pending));
+}
+
+void WebProxy::requestSingleUpdate(std::string id, State &state, std::function<void()> on_update) {
   auto url = _base_url + (id.starts_with('/') ? "" : "/") + std::string(id);
+  auto headers = http::Headers{{"content-type", "application/json"}};
+  // Polls only fetch the state, so they're safe to send twice. Actions are not.
+  auto is_poll = id.find('?') == std::string::npos;
+  if (!state.etag.empty() && is_poll) {
+    headers["if-none-match"] = state.etag;
+  }
+  _last_request_at = std::chrono::steady_clock::now();
   state.work = _http.request(
       {.method = http::Method::POST,
        .url = std::move(url),
-       .headers = {{"content-type", "application/json"}, {"accept-encoding", "identity"}},
+       .headers = std::move(headers),
        .body = state.data},
       {.post_to = _main_scheduler,
        .on_response = [this, id = std::move(id), &state,
                        on_update = std::move(on_update)](auto res) {
          _state_thingy->onServiceResponse(std::move(res), std::move(id), state);
          on_update ? on_update() : void();
-       }});
+       },
+       .timeout = kUpdateTimeout,
+       .hedge = is_poll});
+}
+
+void WebProxy::sendBatch() {
+  auto pending = std::exchange(_pending_updates, {});
+
+  // A lone update keeps its validator by going out on its own.
+  if (pending.size() == 1) {
+    auto &[id, on_updates] = *pending.begin();
+    if (auto *state = _state_thingy->findState(id)) {
+      requestSingleUpdate(id, *state, callAll(std::move(on_updates)));
+    }
+    return;
+  }
+
+  auto states = jv_object();
+  auto ids = std::vector<std::string>();
+  for (auto &[id, on_updates] : pending) {
+    if (auto *state = _state_thingy->findState(id)) {
+      states = jv_object_set(states, jv_string(id.c_str()), jv_string(state->data.c_str()));
+      _in_flight_updates[id] = std::move(on_updates);
+      ids.push_back(id);
+    }
+  }
+  auto jv = jv_object();
+  jv = jv_object_set(jv, jv_string("states"), states);
+  jv = jv_dump_string(jv, 0);
+  auto body = std::string(jv_string_value(jv));
+  jv_free(jv);
+
+  std::cout << "Updating " << ids.size() << " states in one request" << std::endl;
+  auto key = _next_batch_key++;
+  _last_request_at = std::chrono::steady_clock::now();
+  _batch_requests[key] = _http.request(
+      {.method = http::Method::POST,
+       .url = _base_url + "/batch",
+       .headers = {{"content-type", "application/json"}},
+       .body = std::move(body)},
+      {.post_to = _main_scheduler,
+       .on_response =
+           [this, key, ids = std::move(ids)](auto res) {
+             onBatchResponse(std::move(res), key, std::move(ids));
+           },
+       .timeout = kUpdateTimeout,
+       .hedge = true});
+}
+
+void WebProxy::onBatchResponse(http::Response res, uint64_t key, std::vector<std::string> ids) {
+  _batch_requests.erase(key);
+
+  auto on_updates = std::map<std::string, std::vector<std::function<void()>>>();
+  auto dirty = std::map<std::string, std::vector<std::function<void()>>>();
+  for (auto &id : ids) {
+    if (auto it = _in_flight_updates.find(id); it != _in_flight_updates.end()) {
+      on_updates[id] = std::move(it->second);
+      _in_flight_updates.erase(it);
+    }
+    if (auto it = _dirty_updates.find(id); it != _dirty_updates.end()) {
+      dirty[id] = std::move(it->second);
+      _dirty_updates.erase(it);
+    }
+  }
+
+  if (res.status == 404 || res.status == 405 || res.status == 501) {
+    std::cerr << "Batched updates unsupported (status " << res.status
+              << "), sending them one by one" << std::endl;
+    _batching = false;
+    // With the data as it is now, which covers updates requested in the meantime as well.
+    for (auto &id : ids) {
+      if (auto *state = _state_thingy->findState(id)) {
+        auto &callbacks = on_updates[id];
+        std::move(dirty[id].begin(), dirty[id].end(), std::back_inserter(callbacks));
+        requestSingleUpdate(id, *state, callAll(std::move(callbacks)));
+      }
+    }
+    return;
+  }
+
+  _state_thingy->onBatchResponse(std::move(res), ids);
+  for (auto &[id, callbacks] : on_updates) {
+    callAll(std::move(callbacks))();
+  }
+  for (auto &[id, callbacks] : dirty) {
+    if (_state_thingy->findState(id)) {
+      queueUpdate(id, std::move(callbacks));
+    }
+  }
+}
+
+void WebProxy::keepAlive() {
+  auto now = std::chrono::steady_clock::now();
+  if (_connected && now - _last_request_at < kKeepAliveInterval) {
+    return;
+  }
+  _last_request_at = now;
+  _keep_alive = _http.request(
+      {.method = http::Method::HEAD,
+       .url = _base_url,
+       .headers = {{"x-device-id", std::string(_device_id)}}},
+      {.post_to = _main_scheduler,
+       .on_response =
+           [this, now](auto res) {
+             // Failed, try again on the next round.
+             if (res.status >= 500) {
+               return;
+             }
+             if (!std::exchange(_connected, true)) {
+               auto elapsed = std::chrono::steady_clock::now() - now;
+               std::cout << "Connected to " << _base_host << " in "
+                         << duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms"
+                         << std::endl;
+             }
+           },
+       .timeout = kUpdateTimeout});
 }
 
 }  // namespace web_proxy
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <chrono>
+#include <map>
+#include <optional>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "async/scheduler.h"
+#include "event_hub.h"
 #include "http/http.h"
+#include "push_channel.h"
 #include "render/renderer.h"
 #include "state_thingy.h"
 
@@ -12,6 +19,8 @@ namespace web_proxy {
 class WebProxy {
  public:
   using RequestHandler = std::function<http::Lifetime(http::Request, http::RequestOptions)>;
+  using FastHandler =
+      std::function<std::shared_ptr<const http::CachedResponse>(const http::Request &)>;
 
   WebProxy(async::Scheduler &,
            http::Http &,
@@ -21,18 +30,56 @@ class WebProxy {
   ~WebProxy();
 
   RequestHandler asRequestHandler();
+  // Answers GETs for states on the calling thread, without waiting for the main thread.
+  FastHandler asFastHandler();
   void updateState(std::string id);
+  // That states are displayed with.
+  render::Renderer &renderer() { return _state_thingy->renderer(); }
+  // Subscribes to updates pushed by the backend, on top of polling.
+  void enablePush();
 
  private:
+  std::string backendUrl(std::string_view url) const;
   http::Lifetime handleRequest(http::Request, http::RequestOptions);
   void requestStateUpdate(std::string id, State &, std::function<void()> on_update);
+  void requestSingleUpdate(std::string id, State &, std::function<void()> on_update);
+  void queueUpdate(std::string id, std::vector<std::function<void()>> on_updates);
+  void sendBatch();
+  void onBatchResponse(http::Response, uint64_t key, std::vector<std::string> ids);
+  void keepAlive();
 
   async::Scheduler &_main_scheduler;
   http::Http &_http;
   std::string _base_url;
   std::string_view _base_host;
   std::string_view _device_id;
+  // Outlives the states and the renderer, which publish to it.
+  std::unique_ptr<EventHub> _event_hub;
   std::unique_ptr<StateThingy> _state_thingy;
+  std::unique_ptr<PushChannel> _push_channel;
+
+  // Updates requested within a short window are sent together, and updates for states that are
+  // already pending are folded into those. Those for states in flight are held until the batch
+  // is back, and then sent with the data as it is by then.
+  //
+  // Together means one POST to <base url>/batch with {"states": {"<id>": "<data>", ...}}, the
+  // ids and data of a single update each. The backend answers 200 with an object of states by
+  // id, as for a single update, holding those of the states it has news of. The others poll
+  // again as if they had been unchanged. A backend without the endpoint answers 404, 405 or 501,
+  // and updates go out one by one from then on.
+  std::map<std::string, std::vector<std::function<void()>>> _pending_updates;
+  std::unordered_map<std::string, std::vector<std::function<void()>>> _in_flight_updates;
+  std::unordered_map<std::string, std::vector<std::function<void()>>> _dirty_updates;
+  std::unordered_map<uint64_t, http::Lifetime> _batch_requests;
+  uint64_t _next_batch_key = 0;
+  bool _batching = true;
+  async::Lifetime _batch_work;
+
+  // The connection to the backend is opened at startup, and kept open while otherwise idle.
+  std::chrono::steady_clock::time_point _last_request_at;
+  bool _connected = false;
+  http::Lifetime _keep_alive;
+  async::Lifetime _keep_alive_work;
 };
 
 }  // namespace web_proxy